@@ -25,6 +25,11 @@
 // 
 //------------------------------------------------------------------------
 
+#ifndef SYZYGY_H
+#define SYZYGY_H
+
+#include <stdint.h>
+
 
 // LIBRARY PARAMETERS
 // Constraints that apply to this library itself
@@ -34,33 +39,62 @@
 #define SVIO_IMPL_VER_MINOR (1)
 
 // CARRIER-SPECIFIC PARAMETERS
-// Complete these constant definitions with those appropriate to your carrier.
+// Complete these constant definitions with those appropriate to your carrier,
+// or define them on the command line when building for several carriers.
 // Number of ports on the most populous SmartVIO group, including FPGA constraints.
 
 // Total number of SmartVIO groups. This corresponds to the number of unique
 // SmartVIO voltages provided by the carrier.
+#ifndef SVIO_NUM_GROUPS
 #define SVIO_NUM_GROUPS             (2)
+#endif
 
 // Maximum number of SYZYGY ports on a single SmartVIO group for the system.
 // The FPGA side of a SYZYGY connection counts as a port here.
+#ifndef SVIO_MAX_PORTS
 #define SVIO_MAX_PORTS              (4)
+#endif
 
 // Total number of SmartVIO ports in the system.
 // The FPGA side of a SYZYGY connection counts as a port here.
+#ifndef SVIO_NUM_PORTS
 #define SVIO_NUM_PORTS              (6)
+#endif
 
 // Maximum number of SmartVIO ranges definable in the DNA.
 #define SZG_ATTR_LVDS                       (0x0001)
 #define SZG_ATTR_DOUBLEWIDE                 (0x0002)
 #define SZG_ATTR_TXR4                       (0x0004)
 
+// Highest voltage considered by the SmartVIO solvers, in 10 mV units.
+#define SZG_SVIO_MAX_VOLTAGE                (500)
+
+// Solver methods for szgSolveSmartVIO.
+#define SZG_SOLVE_FIRST_FOUND               (0)
+#define SZG_SOLVE_SWEEP                     (1)
+#define SZG_SOLVE_BITSET_LOW                (2)
+#define SZG_SOLVE_BITSET_HIGH               (3)
+#define SZG_SOLVE_BITSET_CENTER             (4)
+
+// Number of 64-bit words in a voltage map, a bitmap with bit v set for each
+// supported voltage v in 0 to SZG_SVIO_MAX_VOLTAGE.
+#define SZG_SVIO_MAP_WORDS                  ((SZG_SVIO_MAX_VOLTAGE + 64) / 64)
+
 // Maximum number of SmartVIO ranges defined in the DNA header.
 #define SZG_MAX_DNA_RANGES                  (4)
 
 // Maximum length of an I2C read supported by the DNA firmware.
 #define SZG_MAX_DNA_I2C_READ_LENGTH         (32)
+
+// Write page size and nominal write cycle of the DNA storage of peripherals
+// whose firmware is not otherwise known.
+#define SZG_DNA_PAGE_SIZE                   (32)
+#define SZG_DNA_WRITE_CYCLE_US              (4000)
 #define SZG_DNA_HEADER_LENGTH_V1            (40)
 
+// Maximum length of a complete DNA, header and strings included.
+#define SZG_DNA_MAX_LENGTH                  (1318)
+
 #define SZG_DNA_PTR_FULL_LENGTH             (0)
 #define SZG_DNA_PTR_HEADER_LENGTH           (2)
 #define SZG_DNA_PTR_DNA_MAJOR               (4)
@@ -87,6 +121,9 @@
 #define SZG_DNA_CRC16_HIGH                  (38)
 #define SZG_DNA_CRC16_LOW                   (39)
 
+// Initial value of the CRC-16/CCITT register, see szgCRCUpdate.
+#define SZG_CRC_INIT                        (0xFFFF)
+
 
 typedef struct {
 	int      min;
@@ -131,8 +168,35 @@ typedef struct {
 #define szgMIN(a,b)  ((a)<(b) ? (a) : (b))
 
 
-int szgParsePortDNA(int n, szgSmartVIOConfig *svio, unsigned char *dnaBuf, int length);
+int szgParsePortDNA(int n, szgSmartVIOConfig *svio, const unsigned char *dnaBuf, int length);
 
 int szgSolveSmartVIOGroup(szgSmartVIOPort *ports, int group_mask);
 
+int szgSolveSmartVIO(szgSmartVIOPort *ports, int group_mask, int method);
+
+int szgSolveSmartVIOComponents(szgSmartVIOPort *ports, const int *group_masks,
+                               int num_groups, int *results, int method);
+
+void szgPortVoltageMap(const szgSmartVIOPort *port, uint64_t *map);
+
+void szgVoltageMapAnd(uint64_t *dst, const uint64_t *src);
+
+int szgVoltageMapPick(const uint64_t *map, int pick);
+
 unsigned short szgComputeCRC(const unsigned char *data, unsigned int length);
+
+unsigned short szgCRCUpdate(unsigned short crc, const unsigned char *data, unsigned int length);
+
+void szgComputeCRCs(const unsigned char *const *data, const unsigned int *lengths,
+                    unsigned short *crcs, unsigned int count);
+
+unsigned int szgCheckDNAHeaders(const unsigned char *dna, unsigned int count,
+                                unsigned int stride, unsigned char *valid);
+
+int szgDNAMaxReadLength(const unsigned char *dnaBuf);
+
+int szgDNAPageSize(const unsigned char *dnaBuf);
+
+int szgDNAWriteCycleUs(const unsigned char *dnaBuf);
+
+#endif // SYZYGY_H
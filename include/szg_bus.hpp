@@ -0,0 +1,92 @@
+// SYZYGY Bus Policies
+//
+// Compile-time selectable bus backends for the SYZYGY Brain tools.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+#ifndef SZG_BUS_HPP
+#define SZG_BUS_HPP
+
+#include <stdint.h>
+
+#include "szg_dev.hpp"
+
+
+// A bus policy supplies every transfer the SmartVIO and sequencer logic
+// performs. The tool code is written as templates over the policy, so a
+// backend is chosen when the binary is built and calls are resolved
+// statically, with no virtual dispatch. Each policy provides:
+//
+//   int  open(const char *name)
+//   void close()
+//   int  i2cDetect(int i2c_addr)
+//   int  i2cWrite(int i2c_addr, uint16_t sub_addr, int sub_addr_length,
+//                 int length, const uint8_t *data)
+//   int  i2cRead(int i2c_addr, uint16_t sub_addr, int sub_addr_length,
+//                int length, uint8_t *data)
+//   int  writeMCU(uint16_t port_addr, int sub_addr, const uint8_t *data,
+//                 int length)
+//   int  readMCU(uint16_t port_addr, int sub_addr, uint8_t *data, int length)
+//   int  detectReadMCU(uint16_t port_addr, int sub_addr, uint8_t *data,
+//                      int length)
+//   int  setChunkLength(int i2c_addr, int length)
+//   int  setPageSize(int i2c_addr, int page_size)
+//   int  writeCycleUs(int i2c_addr)
+//   unsigned long transactions()
+//   uint64_t timeUs()
+//
+// with the same return conventions as the functions of szg_i2c.h.
+// transactions() returns the number of adapter calls issued so far, and
+// timeUs() the time on the backend's clock, in microseconds. writeCycleUs()
+// returns the write cycle writeMCU measured for a device, 0 if unknown.
+
+
+// Backend used by the tools, selected at compile time:
+//   default          - szgDevBus, the Linux i2c-dev device
+//   -DSZG_BUS_SIM    - szgSimBus, the in-process carrier simulator
+//   -DSZG_BUS_RECORD - szgDevBus, logging every operation to a trace
+//   -DSZG_BUS_REPLAY - szgReplayBus, serving a recorded trace
+#if defined(SZG_BUS_SIM)
+#include "szg_sim.hpp"
+typedef szgSimBus szgBus;
+#elif defined(SZG_BUS_RECORD)
+#include "szg_trace.hpp"
+typedef szgRecordBus<szgDevBus> szgBus;
+#elif defined(SZG_BUS_REPLAY)
+#include "szg_trace.hpp"
+typedef szgReplayBus szgBus;
+#else
+typedef szgDevBus szgBus;
+#endif
+
+// Whether the tools keep a DNA cache in the default location when
+// $SZG_DNA_CACHE_DIR is not set. Simulated and replayed carriers are not
+// the host's, so those builds only cache into a directory given to them.
+#if defined(SZG_BUS_SIM) || defined(SZG_BUS_REPLAY)
+#define SZG_BUS_DEFAULT_DNA_CACHE           (0)
+#else
+#define SZG_BUS_DEFAULT_DNA_CACHE           (1)
+#endif
+
+#endif // SZG_BUS_HPP
@@ -0,0 +1,263 @@
+// SYZYGY Carrier Descriptions
+//
+// Compile-time descriptions of the SmartVIO layout of SYZYGY carriers.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+#ifndef SZG_CARRIER_HPP
+#define SZG_CARRIER_HPP
+
+#include <string.h>
+
+extern "C" {
+#include "syzygy.h"
+}
+
+// One SmartVIO port of a carrier. A port with an i2c_addr of 0x00 is the
+// FPGA side of its group, constraining it to the range vmin to vmax in 10 mV
+// units. Any other port is a SYZYGY port whose peripheral MCU answers at
+// i2c_addr. The doublewide_mate is the group joined with this port's group
+// when a doublewide peripheral is connected, or the port's own group.
+struct szgCarrierPort {
+	int i2c_addr;
+	int group;
+	int doublewide_mate;
+	int vmin;
+	int vmax;
+};
+
+// A carrier is a type providing:
+//
+//   static constexpr int num_groups;
+//   static constexpr int num_ports;
+//   static constexpr const szgCarrierPort &port(int n);
+//   static constexpr int groupMask(int group);
+//
+// SYZYGY ports are numbered from 1 in the order they appear in the port
+// table. Tools built for a carrier iterate over num_ports with constant
+// bounds, and szgCarrierInit checks the description when it is instantiated.
+
+// Brain-1: 2 SmartVIO groups, FPGA range 1.2 to 3.3 V on both
+// Group 1 has 1 port, group 2 has 3 ports
+constexpr szgCarrierPort szgBrain1Ports[] = {
+	// Group 1
+	{ 0x00, 0, 0, 120, 330 },
+	{ 0x30, 0, 0, 0, 0 },
+	// Group 2
+	{ 0x00, 1, 1, 120, 330 },
+	{ 0x31, 1, 1, 0, 0 },
+	{ 0x32, 1, 1, 0, 0 },
+	{ 0x33, 1, 1, 0, 0 },
+};
+
+constexpr int szgBrain1GroupMasks[] = { 0x1, 0x2 };
+
+struct szgBrain1Carrier {
+	static constexpr int num_groups = 2;
+	static constexpr int num_ports = 6;
+
+	static constexpr const szgCarrierPort &port (int n)
+	{
+		return szgBrain1Ports[n];
+	}
+
+	static constexpr int groupMask (int group)
+	{
+		return szgBrain1GroupMasks[group];
+	}
+};
+
+
+// Compile-time queries on a carrier. C++11 constexpr functions are a single
+// return statement, so the table walks are written as recursion on an index.
+
+// Number of ports in 'group' with an i2c_addr of 0x00 if 'host' is set, or
+// of SYZYGY ports otherwise
+template <class Carrier>
+constexpr int szgCarrierGroupPorts (int group, bool host, int i = 0)
+{
+	return (i == Carrier::num_ports) ? 0 :
+	       (((Carrier::port(i).group == group)
+	         && ((Carrier::port(i).i2c_addr == 0x00) == host)) ? 1 : 0)
+	       + szgCarrierGroupPorts<Carrier>(group, host, i + 1);
+}
+
+// Number of SYZYGY ports on the carrier
+template <class Carrier>
+constexpr int szgCarrierPeripherals (int i = 0)
+{
+	return (i == Carrier::num_ports) ? 0 :
+	       ((Carrier::port(i).i2c_addr != 0x00) ? 1 : 0)
+	       + szgCarrierPeripherals<Carrier>(i + 1);
+}
+
+// I2C address of SYZYGY port n + 1, 0x00 if the carrier has no such port
+template <class Carrier>
+constexpr int szgCarrierPeripheral (int n, int i = 0)
+{
+	return (i == Carrier::num_ports) ? 0x00 :
+	       (Carrier::port(i).i2c_addr == 0x00) ? szgCarrierPeripheral<Carrier>(n, i + 1) :
+	       (n == 0) ? Carrier::port(i).i2c_addr :
+	       szgCarrierPeripheral<Carrier>(n - 1, i + 1);
+}
+
+// Index in the port table of the FPGA side of 'group', -1 if it has none
+template <class Carrier>
+constexpr int szgCarrierHostPort (int group, int i = 0)
+{
+	return (i == Carrier::num_ports) ? -1 :
+	       ((Carrier::port(i).group == group) && (Carrier::port(i).i2c_addr == 0x00)) ? i :
+	       szgCarrierHostPort<Carrier>(group, i + 1);
+}
+
+// Every group mask is the single bit of its group, as the solvers select a
+// port's group with (1 << group)
+template <class Carrier>
+constexpr bool szgCarrierMasksValid (int group = 0)
+{
+	return (group == Carrier::num_groups)
+	       || ((Carrier::groupMask(group) == (1 << group))
+	           && szgCarrierMasksValid<Carrier>(group + 1));
+}
+
+// No port other than port i answers at 'addr'
+template <class Carrier>
+constexpr bool szgCarrierAddressUnique (int addr, int i, int j)
+{
+	return (j == Carrier::num_ports)
+	       || ((j == i || Carrier::port(j).i2c_addr != addr)
+	           && szgCarrierAddressUnique<Carrier>(addr, i, j + 1));
+}
+
+// Every port is in a group, the FPGA side of each group has a valid range
+// and each SYZYGY port has its own 7-bit address
+template <class Carrier>
+constexpr bool szgCarrierPortsValid (int i = 0)
+{
+	return (i == Carrier::num_ports)
+	       || ((Carrier::port(i).group >= 0)
+	           && (Carrier::port(i).group < Carrier::num_groups)
+	           && ((Carrier::port(i).i2c_addr != 0x00)
+	               || ((Carrier::port(i).vmin >= 1)
+	                   && (Carrier::port(i).vmin <= Carrier::port(i).vmax)
+	                   && (Carrier::port(i).vmax <= SZG_SVIO_MAX_VOLTAGE)))
+	           && ((Carrier::port(i).i2c_addr == 0x00)
+	               || ((Carrier::port(i).i2c_addr < 0x80)
+	                   && szgCarrierAddressUnique<Carrier>(Carrier::port(i).i2c_addr, i, 0)))
+	           && szgCarrierPortsValid<Carrier>(i + 1));
+}
+
+// Every group has exactly one FPGA side and fits SVIO_MAX_PORTS
+template <class Carrier>
+constexpr bool szgCarrierGroupsValid (int group = 0)
+{
+	return (group == Carrier::num_groups)
+	       || ((szgCarrierGroupPorts<Carrier>(group, true) == 1)
+	           && (szgCarrierGroupPorts<Carrier>(group, true)
+	               + szgCarrierGroupPorts<Carrier>(group, false) <= SVIO_MAX_PORTS)
+	           && szgCarrierGroupsValid<Carrier>(group + 1));
+}
+
+// Doublewide mates are SYZYGY ports in another group, and are paired: a
+// port in 'group' mated to 'mate' needs a port in 'mate' mated to 'group'
+template <class Carrier>
+constexpr bool szgCarrierHasMate (int group, int mate, int i = 0)
+{
+	return (i < Carrier::num_ports)
+	       && (((Carrier::port(i).group == group)
+	            && (Carrier::port(i).doublewide_mate == mate)
+	            && (Carrier::port(i).i2c_addr != 0x00))
+	           || szgCarrierHasMate<Carrier>(group, mate, i + 1));
+}
+
+template <class Carrier>
+constexpr bool szgCarrierMatesValid (int i = 0)
+{
+	return (i == Carrier::num_ports)
+	       || ((Carrier::port(i).doublewide_mate >= 0)
+	           && (Carrier::port(i).doublewide_mate < Carrier::num_groups)
+	           && ((Carrier::port(i).doublewide_mate == Carrier::port(i).group)
+	               || ((Carrier::port(i).i2c_addr != 0x00)
+	                   && szgCarrierHasMate<Carrier>(Carrier::port(i).doublewide_mate,
+	                                                 Carrier::port(i).group)))
+	           && szgCarrierMatesValid<Carrier>(i + 1));
+}
+
+
+// Reset 'svio' to the carrier's layout with no peripherals present
+template <class Carrier>
+void szgCarrierInit (szgSmartVIOConfig *svio)
+{
+	static_assert(Carrier::num_groups >= 1 && Carrier::num_groups <= SVIO_NUM_GROUPS,
+	              "carrier groups must fit SVIO_NUM_GROUPS");
+	static_assert(Carrier::num_ports >= 1 && Carrier::num_ports <= SVIO_NUM_PORTS,
+	              "carrier ports must fit SVIO_NUM_PORTS");
+	static_assert(szgCarrierMasksValid<Carrier>(),
+	              "carrier group masks must be the single bit of their group");
+	static_assert(szgCarrierPortsValid<Carrier>(),
+	              "carrier ports need a valid group, FPGA range and unique address");
+	static_assert(szgCarrierGroupsValid<Carrier>(),
+	              "carrier groups need one FPGA side and at most SVIO_MAX_PORTS ports");
+	static_assert(szgCarrierMatesValid<Carrier>(),
+	              "carrier doublewide mates must be paired SYZYGY ports");
+
+	int i;
+
+	memset(svio, 0, sizeof(*svio));
+
+	svio->num_ports = Carrier::num_ports;
+	svio->num_groups = Carrier::num_groups;
+
+	for (i = 0; i < Carrier::num_groups; i++) {
+		svio->group_masks[i] = Carrier::groupMask(i);
+	}
+
+	for (i = 0; i < Carrier::num_ports; i++) {
+		const szgCarrierPort &port = Carrier::port(i);
+
+		svio->ports[i].i2c_addr = port.i2c_addr;
+		svio->ports[i].group = port.group;
+		svio->ports[i].doublewide_mate = port.doublewide_mate;
+
+		// The FPGA side is always present
+		if (port.i2c_addr == 0x00) {
+			svio->ports[i].present = 1;
+			svio->ports[i].range_count = 1;
+			svio->ports[i].ranges[0].min = port.vmin;
+			svio->ports[i].ranges[0].max = port.vmax;
+		}
+	}
+}
+
+
+// Carrier the tools are built for, selected at compile time with
+// -DSZG_CARRIER=<carrier type>. The C library sizes its tables with
+// SVIO_NUM_GROUPS and SVIO_NUM_PORTS, which may be set to match.
+#ifndef SZG_CARRIER
+#define SZG_CARRIER szgBrain1Carrier
+#endif
+
+typedef SZG_CARRIER szgCarrier;
+
+#endif // SZG_CARRIER_HPP
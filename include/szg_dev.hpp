@@ -0,0 +1,144 @@
+// SYZYGY i2c-dev Bus Policy
+//
+// Bus policy driving the szg_i2c transport on a Linux i2c-dev device.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+#ifndef SZG_DEV_HPP
+#define SZG_DEV_HPP
+
+#include <stdint.h>
+
+extern "C" {
+#include "szg_i2c.h"
+}
+
+
+// Linux i2c-dev backend. Devices are reached through per-device handles of
+// an szgI2CPool, while combined probing reads use the shared handle.
+// szgSimBus runs the same policy with the pool opened on a simulated
+// adapter.
+class szgDevBus {
+public:
+	int open (const char *name)
+	{
+		return szgI2CPoolOpen(&pool, name);
+	}
+
+	void close ()
+	{
+		szgI2CPoolClose(&pool);
+	}
+
+	int i2cDetect (int i2c_addr)
+	{
+		szgI2CBus *dev = szgI2CPoolDevice(&pool, i2c_addr);
+
+		return (dev == NULL) ? -1 : ::i2cDetect(dev, i2c_addr);
+	}
+
+	int i2cWrite (int i2c_addr, uint16_t sub_addr, int sub_addr_length,
+	              int length, const uint8_t *data)
+	{
+		szgI2CBus *dev = szgI2CPoolDevice(&pool, i2c_addr);
+
+		return (dev == NULL) ? -1 : ::i2cWrite(dev, i2c_addr, sub_addr,
+		                                       sub_addr_length, length, data);
+	}
+
+	int i2cRead (int i2c_addr, uint16_t sub_addr, int sub_addr_length,
+	             int length, uint8_t *data)
+	{
+		szgI2CBus *dev = szgI2CPoolDevice(&pool, i2c_addr);
+
+		return (dev == NULL) ? -1 : ::i2cRead(dev, i2c_addr, sub_addr,
+		                                      sub_addr_length, length, data);
+	}
+
+	int writeMCU (uint16_t port_addr, int sub_addr, const uint8_t *data,
+	              int length)
+	{
+		szgI2CBus *dev = szgI2CPoolDevice(&pool, port_addr);
+
+		return (dev == NULL) ? -1 : ::writeMCU(dev, port_addr, sub_addr,
+		                                       data, length);
+	}
+
+	int readMCU (uint16_t port_addr, int sub_addr, uint8_t *data, int length)
+	{
+		szgI2CBus *dev = szgI2CPoolDevice(&pool, port_addr);
+
+		return (dev == NULL) ? -1 : ::readMCU(dev, port_addr, sub_addr,
+		                                      data, length);
+	}
+
+	int detectReadMCU (uint16_t port_addr, int sub_addr, uint8_t *data,
+	                   int length)
+	{
+		return ::detectReadMCU(&pool.bus, port_addr, sub_addr, data, length);
+	}
+
+	int setChunkLength (int i2c_addr, int length)
+	{
+		szgI2CBus *dev = szgI2CPoolDevice(&pool, i2c_addr);
+
+		return (dev == NULL) ? -1 : szgI2CSetChunkLength(dev, i2c_addr, length);
+	}
+
+	int setPageSize (int i2c_addr, int page_size)
+	{
+		szgI2CBus *dev = szgI2CPoolDevice(&pool, i2c_addr);
+
+		return (dev == NULL) ? -1 : szgI2CSetPageSize(dev, i2c_addr, page_size);
+	}
+
+	int writeCycleUs (int i2c_addr)
+	{
+		szgI2CBus *dev = szgI2CPoolDevice(&pool, i2c_addr);
+
+		return (dev == NULL) ? 0 : szgI2CWriteCycle(dev, i2c_addr);
+	}
+
+	unsigned long transactions ()
+	{
+		unsigned long count = pool.bus.transactions;
+		int i;
+
+		for (i = 0; i < pool.count; i++) {
+			count += pool.devs[i].transactions;
+		}
+
+		return count;
+	}
+
+	uint64_t timeUs ()
+	{
+		return szgI2CBusTimeUs(&pool.bus);
+	}
+
+protected:
+	szgI2CPool pool;
+};
+
+#endif // SZG_DEV_HPP
@@ -0,0 +1,254 @@
+// SYZYGY DNA
+//
+// Zero-copy view of a peripheral DNA held in a single owned buffer, and an
+// on-disk cache of the DNAs seen on each port.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+
+#ifndef SZG_DNA_HPP
+#define SZG_DNA_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+extern "C" {
+#include "syzygy.h"
+}
+
+
+// A string stored in a DNA. Points into the buffer of the szgDNA it came
+// from and is only valid as long as that buffer is.
+struct szgDNAString {
+	const char *data;
+	int         length;
+
+	std::string str () const { return std::string(data, length); }
+};
+
+
+// A complete peripheral DNA, header and strings, in one buffer. Fields are
+// decoded from the buffer when asked for rather than copied out up front,
+// so the same bytes back the SmartVIO solver (through parse), the reports
+// and the DNA dumps.
+//
+// The buffer is filled through data() and committed with setLength(), for
+// instance by reading the header into it, then the rest of the DNA once
+// fullLength() is known.
+class szgDNA {
+public:
+	szgDNA () : length(0) {}
+
+	uint8_t *data () { return buf; }
+	const uint8_t *data () const { return buf; }
+
+	// Number of valid bytes in the buffer
+	int size () const { return length; }
+
+	void setLength (int n)
+	{
+		length = (n < 0) ? 0 : (n > SZG_DNA_MAX_LENGTH) ? SZG_DNA_MAX_LENGTH : n;
+	}
+
+	// True when a full header is present and its CRC checks out
+	bool headerValid () const
+	{
+		return (length >= SZG_DNA_HEADER_LENGTH_V1)
+		       && (szgComputeCRC(buf, SZG_DNA_HEADER_LENGTH_V1) == 0);
+	}
+
+	// Fills port 'n' of 'svio' for the SmartVIO solver, returns 0 on success
+	int parse (int n, szgSmartVIOConfig *svio) const
+	{
+		return szgParsePortDNA(n, svio, buf, length);
+	}
+
+	// Header fields
+	int fullLength () const { return u16(SZG_DNA_PTR_FULL_LENGTH); }
+	int headerLength () const { return u16(SZG_DNA_PTR_HEADER_LENGTH); }
+	int dnaMajor () const { return buf[SZG_DNA_PTR_DNA_MAJOR]; }
+	int dnaMinor () const { return buf[SZG_DNA_PTR_DNA_MINOR]; }
+	int requiredMajor () const { return buf[SZG_DNA_PTR_DNA_REQUIRED_MAJOR]; }
+	int requiredMinor () const { return buf[SZG_DNA_PTR_DNA_REQUIRED_MINOR]; }
+	int max5VLoad () const { return u16(SZG_DNA_PTR_MAX_5V_LOAD); }
+	int max33VLoad () const { return u16(SZG_DNA_PTR_MAX_33V_LOAD); }
+	int maxVIOLoad () const { return u16(SZG_DNA_PTR_MAX_VIO_LOAD); }
+	int attributes () const { return u16(SZG_DNA_PTR_ATTRIBUTES); }
+	int crc () const { return (buf[SZG_DNA_CRC16_HIGH] << 8) | buf[SZG_DNA_CRC16_LOW]; }
+
+	// Number of SmartVIO ranges, which end at the first all-zero range
+	int rangeCount () const
+	{
+		int i;
+
+		for (i = 0; i < SZG_MAX_DNA_RANGES; i++) {
+			if ((range(i).min == 0) && (range(i).max == 0)) {
+				break;
+			}
+		}
+
+		return i;
+	}
+
+	szgSmartVIORange range (int n) const
+	{
+		szgSmartVIORange r;
+
+		r.min = u16(SZG_DNA_MIN_VIO_RANGE0 + n * 4);
+		r.max = u16(SZG_DNA_MAX_VIO_RANGE0 + n * 4);
+
+		return r;
+	}
+
+	// Strings, in the order they follow the header
+	szgDNAString manufacturer () const { return string(0); }
+	szgDNAString productName () const { return string(1); }
+	szgDNAString productModel () const { return string(2); }
+	szgDNAString productVersion () const { return string(3); }
+	szgDNAString serialNumber () const { return string(4); }
+
+	// Offset just past the last string, the least a DNA read must cover
+	int stringsEnd () const { return stringOffset(5); }
+
+	// Replaces the serial number, moving any bytes that follow it and
+	// updating the string length, full length and header CRC, so that a
+	// template DNA can be stamped for each unit. Returns 0 on success, -1
+	// if the DNA is incomplete or the result would not fit.
+	int setSerialNumber (const char *serial, int serial_length)
+	{
+		int offset = stringOffset(4);
+		int old_length = buf[SZG_DNA_SERIAL_NUMBER_LENGTH];
+		int new_size = length - old_length + serial_length;
+		int full_length = fullLength() - old_length + serial_length;
+		unsigned short crc;
+
+		if (!headerValid() || (length < offset + old_length)
+		    || (serial_length > 0xFF) || (new_size > SZG_DNA_MAX_LENGTH)
+		    || (full_length > SZG_DNA_MAX_LENGTH)) {
+			return -1;
+		}
+
+		memmove(&buf[offset + serial_length], &buf[offset + old_length],
+		        length - offset - old_length);
+		memcpy(&buf[offset], serial, serial_length);
+		length = new_size;
+
+		buf[SZG_DNA_SERIAL_NUMBER_LENGTH] = serial_length;
+		buf[SZG_DNA_PTR_FULL_LENGTH] = full_length & 0xFF;
+		buf[SZG_DNA_PTR_FULL_LENGTH + 1] = (full_length >> 8) & 0xFF;
+
+		crc = szgComputeCRC(buf, SZG_DNA_CRC16_HIGH);
+		buf[SZG_DNA_CRC16_HIGH] = (crc >> 8) & 0xFF;
+		buf[SZG_DNA_CRC16_LOW] = crc & 0xFF;
+
+		return 0;
+	}
+
+	// Offset of string 'index' (0 manufacturer to 4 serial number)
+	int stringOffset (int index) const
+	{
+		int offset = SZG_DNA_HEADER_LENGTH_V1;
+		int i;
+
+		for (i = 0; i < index; i++) {
+			offset += buf[SZG_DNA_MANUFACTURER_NAME_LENGTH + i];
+		}
+
+		return offset;
+	}
+
+private:
+	int u16 (int offset) const
+	{
+		return buf[offset] | (buf[offset + 1] << 8);
+	}
+
+	// String 'index', cut short at its first NUL or at the end of the
+	// valid data
+	szgDNAString string (int index) const
+	{
+		szgDNAString s;
+		int offset = stringOffset(index);
+		int n = buf[SZG_DNA_MANUFACTURER_NAME_LENGTH + index];
+		const void *nul;
+
+		if (offset + n > length) {
+			n = (offset < length) ? length - offset : 0;
+		}
+
+		s.data = (const char *)&buf[offset];
+		nul = memchr(s.data, '\0', n);
+		s.length = (nul == NULL) ? n : (const char *)nul - s.data;
+
+		return s;
+	}
+
+	uint8_t buf[SZG_DNA_MAX_LENGTH];
+	int     length;
+};
+
+
+// Default location of the DNA cache, overridden by $SZG_DNA_CACHE_DIR.
+#define SZG_DNA_CACHE_DEFAULT_DIR           "/var/cache/smartvio"
+#define SZG_DNA_CACHE_PATH_LENGTH           (256)
+
+
+// Cache of the DNA last read from each port, one file per adapter and port
+// address holding the raw DNA image. An entry is only trusted while the header and
+// serial number read from the peripheral match it, see readDNA in
+// smartvio-brain.cpp, and is replaced or removed as soon as they do not.
+// Files are written to a temporary name and renamed into place, so an
+// interrupted update leaves either the old entry or the new one.
+class szgDNACache {
+public:
+	szgDNACache () { dir[0] = '\0'; adapter[0] = '\0'; }
+
+	// Uses 'path' as the cache directory, creating it if needed, for the
+	// peripherals on the i2c device 'adapter_path'. A NULL path selects
+	// $SZG_DNA_CACHE_DIR or the default location. Returns 0 if the cache is
+	// usable, -1 otherwise, in which case it stays off.
+	int open (const char *path, const char *adapter_path);
+
+	bool enabled () const { return dir[0] != '\0'; }
+
+	// Loads the entry for 'i2c_addr' into 'dna'. Returns 0 if an entry with
+	// a valid header was found, -1 otherwise.
+	int load (int i2c_addr, szgDNA &dna) const;
+
+	// Replaces the entry for 'i2c_addr' with 'dna'. Returns 0 on success.
+	int store (int i2c_addr, const szgDNA &dna) const;
+
+	// Removes the entry for 'i2c_addr', if any.
+	void invalidate (int i2c_addr) const;
+
+private:
+	void entryPath (int i2c_addr, char *path, int length) const;
+
+	char dir[SZG_DNA_CACHE_PATH_LENGTH];
+	// Adapter path with its '/' replaced, prefixing the entry names
+	char adapter[SZG_DNA_CACHE_PATH_LENGTH];
+};
+
+#endif // SZG_DNA_HPP
@@ -0,0 +1,201 @@
+// SYZYGY I2C Transport Library
+//
+// Shared Linux i2c-dev transport used by the SYZYGY Brain tools.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+#ifndef SZG_I2C_H
+#define SZG_I2C_H
+
+#include <stdint.h>
+
+// The DNA Spec allows an MCU to NAK subsequent writes while it commits a
+// previous write. i2cWrite keeps polling for an ACK until this deadline, in
+// microseconds, has passed.
+#define SZG_I2C_WRITE_TIMEOUT_US            (250000)
+
+// Delay before the second write attempt, in microseconds. The delay doubles
+// after each NAK, up to SZG_I2C_POLL_BACKOFF_MAX_US.
+#define SZG_I2C_POLL_BACKOFF_US             (50)
+#define SZG_I2C_POLL_BACKOFF_MAX_US         (2000)
+
+// Default length of a single I2C transfer issued by readMCU/writeMCU. This
+// is the read length every DNA 1.x firmware supports.
+#define SZG_I2C_CHUNK_LENGTH                (32)
+
+// Largest chunk length the transport will use with any peripheral, the
+// longest read in the DNA firmware table of syzygy.c. Transfer buffers are
+// sized from this, so no transfer allocates memory. Raise it along with the
+// table once a firmware serving longer reads exists.
+#define SZG_I2C_MAX_CHUNK_LENGTH            (32)
+
+// Default write page size, 0 meaning unknown. writeMCU never lets a chunk
+// cross a page boundary of a device whose page size is known.
+#define SZG_I2C_PAGE_SIZE                   (0)
+
+// Longest sub-address supported, in bytes.
+#define SZG_I2C_MAX_SUB_ADDR_LENGTH         (2)
+
+// Number of 7-bit I2C addresses tracked by a bus handle.
+#define SZG_I2C_NUM_ADDRS                   (128)
+
+// Maximum number of per-device handles held by an szgI2CPool.
+#define SZG_I2C_POOL_SIZE                   (8)
+
+// Maximum length of an i2c device path, including the terminator.
+#define SZG_I2C_PATH_LENGTH                 (256)
+
+// Presence probing modes for i2cDetect.
+// AUTO  - Use an SMBus quick write when the adapter supports it, otherwise
+//         fall back to the sub-address write.
+// WRITE - Write a two-byte sub-address of 0x0000, as the original tools did.
+// QUICK - Always use an SMBus quick write.
+#define SZG_I2C_PROBE_AUTO                  (0)
+#define SZG_I2C_PROBE_WRITE                 (1)
+#define SZG_I2C_PROBE_QUICK                 (2)
+
+
+// Adapter underneath a bus handle. Handles opened with szgI2COpen talk to a
+// Linux i2c-dev device through open(), ioctl(), read() and write() and keep
+// time with the monotonic clock. Handles opened with szgI2COpenAdapter route
+// those calls to the adapter instead, which must behave like i2c-dev: every
+// open file carries its own I2C_SLAVE address, I2C_FUNCS, I2C_RDWR and
+// I2C_SMBUS quick writes are supported, and a NAK during the address phase
+// fails with errno set to ENXIO. The simulator plugs in here, so the
+// transport runs unchanged against the model.
+typedef struct {
+	void              *ctx;
+	int              (*open)(void *ctx, const char *filename);
+	void             (*close)(void *ctx, int file);
+	int              (*ioctl)(void *ctx, int file, unsigned long request,
+	                          unsigned long arg);
+	int              (*read)(void *ctx, int file, uint8_t *data, int length);
+	int              (*write)(void *ctx, int file, const uint8_t *data,
+	                          int length);
+	uint64_t         (*time_us)(void *ctx);
+	void             (*sleep_us)(void *ctx, unsigned int us);
+} szgI2CAdapter;
+
+
+typedef struct {
+	int                file; // file descriptor for the Linux i2c device
+	// Adapter the file belongs to, NULL for the Linux i2c-dev driver.
+	const szgI2CAdapter *adapter;
+	// Address last programmed with the I2C_SLAVE ioctl, -1 if unknown. Used
+	// to skip the ioctl when consecutive transfers target the same device.
+	int                slave_addr;
+	// Adapter functionality reported by I2C_FUNCS at open time. When the
+	// adapter supports plain I2C messages, reads are issued through I2C_RDWR
+	// with a repeated start between the sub-address and the data.
+	unsigned long      funcs;
+	// Chunk length used by readMCU/writeMCU for each 7-bit address. Starts
+	// at SZG_I2C_CHUNK_LENGTH and may be raised once a peripheral is known
+	// to support longer transfers.
+	uint16_t           chunk_length[SZG_I2C_NUM_ADDRS];
+	// Write page size of each 7-bit address, SZG_I2C_PAGE_SIZE until set.
+	uint16_t           page_size[SZG_I2C_NUM_ADDRS];
+	// Write cycle measured by writeMCU for each 7-bit address, 0 until a
+	// device has NAK'd a write following another. Once known, writeMCU
+	// waits this long between chunks instead of polling for an ACK.
+	uint32_t           write_cycle_us[SZG_I2C_NUM_ADDRS];
+	// Presence probing mode used by i2cDetect, SZG_I2C_PROBE_AUTO by default.
+	int                probe_mode;
+	// ACK polling parameters for i2cWrite, initialized to the defaults above
+	// by szgI2COpen and adjustable by the caller afterwards.
+	unsigned int       write_timeout_us;
+	unsigned int       poll_backoff_us;
+	unsigned int       poll_backoff_max_us;
+	// Number of write attempts made by the most recent i2cWrite call.
+	unsigned int       write_polls;
+	// Number of adapter calls that reached the bus through this handle.
+	unsigned long      transactions;
+} szgI2CBus;
+
+
+// A pool of handles on one i2c adapter, one per target device. Each device
+// handle owns its own file descriptor with the I2C_SLAVE address bound once
+// when it is opened, so transfers never switch addresses on a shared
+// descriptor. Device handles are created on first use; create them before
+// handing them to separate threads.
+typedef struct {
+	char               filename[SZG_I2C_PATH_LENGTH];
+	// Handle used for probing and transfers that name their own address.
+	// Device handles inherit its adapter capabilities and settings.
+	szgI2CBus          bus;
+	int                count;
+	int                addrs[SZG_I2C_POOL_SIZE];
+	szgI2CBus          devs[SZG_I2C_POOL_SIZE];
+} szgI2CPool;
+
+
+uint64_t szgI2CTimeUs(void);
+
+uint64_t szgI2CBusTimeUs(szgI2CBus *bus);
+
+int szgI2COpen(szgI2CBus *bus, const char *filename);
+
+int szgI2COpenAdapter(szgI2CBus *bus, const char *filename,
+                      const szgI2CAdapter *adapter);
+
+void szgI2CClose(szgI2CBus *bus);
+
+int szgI2CSetSlave(szgI2CBus *bus, int i2c_addr);
+
+int szgI2CPoolOpen(szgI2CPool *pool, const char *filename);
+
+int szgI2CPoolOpenAdapter(szgI2CPool *pool, const char *filename,
+                          const szgI2CAdapter *adapter);
+
+void szgI2CPoolClose(szgI2CPool *pool);
+
+szgI2CBus *szgI2CPoolDevice(szgI2CPool *pool, int i2c_addr);
+
+int szgI2CChunkLength(szgI2CBus *bus, int i2c_addr);
+
+int szgI2CSetChunkLength(szgI2CBus *bus, int i2c_addr, int length);
+
+int szgI2CPageSize(szgI2CBus *bus, int i2c_addr);
+
+int szgI2CSetPageSize(szgI2CBus *bus, int i2c_addr, int page_size);
+
+int szgI2CWriteCycle(szgI2CBus *bus, int i2c_addr);
+
+int i2cDetect(szgI2CBus *bus, int i2c_addr);
+
+int i2cWrite(szgI2CBus *bus, int i2c_addr, uint16_t sub_addr,
+             int sub_addr_length, int length, const uint8_t *data);
+
+int i2cRead(szgI2CBus *bus, int i2c_addr, uint16_t sub_addr,
+            int sub_addr_length, int length, uint8_t *data);
+
+int writeMCU(szgI2CBus *bus, uint16_t port_addr, int sub_addr,
+             const uint8_t *data, int length);
+
+int readMCU(szgI2CBus *bus, uint16_t port_addr, int sub_addr, uint8_t *data,
+            int length);
+
+int detectReadMCU(szgI2CBus *bus, uint16_t port_addr, int sub_addr,
+                  uint8_t *data, int length);
+
+#endif // SZG_I2C_H
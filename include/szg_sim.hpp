@@ -0,0 +1,210 @@
+// SYZYGY Carrier Simulator
+//
+// In-process model of a SYZYGY carrier, usable as a bus policy.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+#ifndef SZG_SIM_HPP
+#define SZG_SIM_HPP
+
+#include <stdint.h>
+
+#include "szg_dev.hpp"
+
+extern "C" {
+#include "szg_i2c.h"
+}
+
+
+// Number of peripheral MCUs on the simulated carrier and their addresses.
+#define SZG_SIM_NUM_MCUS                    (4)
+#define SZG_SIM_MCU_BASE_ADDR               (0x30)
+
+// I2C address of the TPS65400 supplying the VIO rails.
+#define SZG_SIM_TPS_ADDR                    (0x6a)
+#define SZG_SIM_TPS_NUM_PAGES               (4)
+
+// TPS65400 registers used by the tools.
+#define SZG_SIM_TPS_REG_PAGE                (0x00)
+#define SZG_SIM_TPS_REG_WRITE_PROTECT       (0x10)
+#define SZG_SIM_TPS_REG_VREF                (0xd8)
+
+// MCU memory map. The DNA is served from 0x8000, sequencer registers from
+// 0x9000. Reads from anywhere else return 0xFF and writes are dropped.
+#define SZG_SIM_DNA_ADDR                    (0x8000)
+#define SZG_SIM_DNA_SIZE                    (2048)
+#define SZG_SIM_SEQ_ADDR                    (0x9000)
+#define SZG_SIM_SEQ_SIZE                    (16)
+
+// Default timing model: a 100 kHz bus, the i2c-dev call overhead measured
+// on a Brain-1, and the time an MCU NAKs while committing a page of a write.
+#define SZG_SIM_BUS_HZ                      (100000)
+#define SZG_SIM_TXN_OVERHEAD_US             (40)
+#define SZG_SIM_WRITE_CYCLE_US              (4000)
+
+// Default write page size of a simulated MCU.
+#define SZG_SIM_PAGE_SIZE                   (32)
+
+// Files the simulated adapter can have open at once: the shared handle of
+// the transport's pool and one per pooled device.
+#define SZG_SIM_NUM_FILES                   (SZG_I2C_POOL_SIZE + 1)
+
+// Longest carrier description open() reads. Descriptions and the files they
+// name are read into fixed buffers so that a simulated run allocates nothing
+// beyond what the tool itself does, see the test target in the Makefile.
+#define SZG_SIM_DESC_SIZE                   (8192)
+
+
+typedef struct {
+	int                present;
+	// Longest read the firmware serves from one message. Longer reads wrap
+	// around to the start of the message, as the DNA firmware buffer does.
+	int                max_read_length;
+	// Write page size of the MCU's storage. A write touching several pages
+	// keeps the MCU busy for one write cycle per page.
+	int                page_size;
+	uint8_t            dna[SZG_SIM_DNA_SIZE];
+	uint8_t            seq[SZG_SIM_SEQ_SIZE];
+	// Sub-address set by the last write, where reads start.
+	int                pointer;
+	// The MCU NAKs every transfer until the simulated clock reaches this
+	// time, modelling its write cycle.
+	uint64_t           busy_until_ns;
+} szgSimMCU;
+
+typedef struct {
+	int                present;
+	uint8_t            write_protect;
+	uint8_t            page;
+	uint8_t            vref[SZG_SIM_TPS_NUM_PAGES];
+	// Register set by the last write, where reads start.
+	uint8_t            reg;
+	// Writes dropped because write protection was active.
+	unsigned long      protected_writes;
+} szgSimTPS;
+
+typedef struct {
+	unsigned long      transactions; // adapter calls reaching the bus
+	unsigned long      messages;     // messages, each with its own (re)start
+	unsigned long      bytes;        // bytes on the wire, including addresses
+	unsigned long      naks;         // transactions NAK'd in the address phase
+	uint64_t           bus_time_ns;  // simulated time spent on the bus
+} szgSimStats;
+
+
+// Bus policy serving a simulated carrier: peripheral MCUs at 0x30-0x33 and
+// the TPS65400 at 0x6a. The policy is szgDevBus with its pool opened on a
+// simulated szgI2CAdapter in place of i2c-dev, so every command runs the real
+// szg_i2c transport, and the model sees the same adapter calls hardware
+// would. Each call is costed from the messages and bytes it carries, so
+// transaction counts and bus time reflect what the command does on hardware.
+// Time is simulated: the transport's clock and sleeps run on it, and nothing
+// really sleeps.
+//
+// open() takes the path of a carrier description with one setting per line:
+//
+//   bus_hz <hz>                   bus clock, e.g. 100000 or 400000
+//   txn_overhead_us <us>          fixed cost of each adapter call
+//   write_cycle_us <us>           MCU busy time per page written
+//   port <n> <dna file>           MCU on port n (1-4) serving a DNA blob
+//   seq <n> <file>                sequencer registers of the MCU on port n
+//   read_length <n> <bytes>       longest read the port n firmware serves
+//   page_size <n> <bytes>         write page size of the port n MCU
+//   tps <0|1>                     presence of the TPS65400
+//   read_last <0|1>               reject I2C_RDWR messages after a read
+//
+// Blank lines and lines starting with '#' are ignored.
+class szgSimBus : public szgDevBus {
+public:
+	szgSimBus ();
+
+	int open (const char *name);
+	void close ();
+
+	// Opens the transport on the carrier as it stands, without reading a
+	// carrier description, and closes it again without a report.
+	int connect (const char *name);
+	void disconnect ();
+
+	// Resets the carrier to an empty state with default timing.
+	void reset ();
+
+	// Prints transfer statistics and the TPS65400 state to stderr.
+	void report ();
+
+	// Stores bytes in an MCU's memory map and marks it present, without any
+	// bus activity or write cycle.
+	void load (int i2c_addr, int sub_addr, const uint8_t *data, int length);
+
+	szgSimMCU *mcu (int i2c_addr);
+
+	// Timing model
+	unsigned int       bus_hz;
+	unsigned int       txn_overhead_us;
+	unsigned int       write_cycle_us;
+
+	// Adapter model. Like the Zynq-7000 PS Cadence controller of a Brain-1,
+	// the default adapter fails an I2C_RDWR call with EOPNOTSUPP when a read
+	// is followed by more messages in the same transfer.
+	int                read_last;
+
+	szgSimMCU          mcus[SZG_SIM_NUM_MCUS];
+	szgSimTPS          tps;
+	szgSimStats        stats;
+	uint64_t           now_ns;
+
+private:
+	// The adapter refers back to this object
+	szgSimBus (const szgSimBus &);
+	szgSimBus &operator= (const szgSimBus &);
+
+	// Simulated i2c-dev, see szgI2CAdapter
+	static int adapterOpen (void *ctx, const char *filename);
+	static void adapterClose (void *ctx, int file);
+	static int adapterIoctl (void *ctx, int file, unsigned long request,
+	                         unsigned long arg);
+	static int adapterRead (void *ctx, int file, uint8_t *data, int length);
+	static int adapterWrite (void *ctx, int file, const uint8_t *data,
+	                         int length);
+	static uint64_t adapterTimeUs (void *ctx);
+	static void adapterSleepUs (void *ctx, unsigned int us);
+
+	int rdwr (void *xfer);
+	int ack (int i2c_addr);
+	void transaction (int messages, int bytes);
+	void nak ();
+	void deviceRead (int i2c_addr, uint8_t *data, int length);
+	void deviceWrite (int i2c_addr, const uint8_t *data, int length);
+	void mcuRead (szgSimMCU *m, int sub_addr, uint8_t *data, int length);
+	void mcuWrite (szgSimMCU *m, int sub_addr, const uint8_t *data,
+	               int length);
+	void tpsWrite (uint8_t reg, uint8_t value);
+	uint8_t tpsRead (uint8_t reg);
+
+	szgI2CAdapter      adapter;
+	// I2C_SLAVE address of each open file, -1 if unset, -2 if not open
+	int                file_addr[SZG_SIM_NUM_FILES];
+};
+
+#endif // SZG_SIM_HPP
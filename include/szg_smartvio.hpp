@@ -0,0 +1,98 @@
+// SYZYGY SmartVIO Context
+//
+// Per-caller state of a SmartVIO solve: the carrier layout, the DNA read
+// from each port and the resulting voltages.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+#ifndef SZG_SMARTVIO_HPP
+#define SZG_SMARTVIO_HPP
+
+#include <string.h>
+
+#include "szg_dna.hpp"
+#include "szg_carrier.hpp"
+
+extern "C" {
+#include "syzygy.h"
+}
+
+// Everything a SmartVIO solve reads and writes. The C library and the solvers
+// only touch the context they are given, so independent contexts can be
+// filled and solved in parallel threads. A context is reused by resetting it.
+class szgSmartVIOContext {
+public:
+	szgSmartVIOContext ()
+	{
+		reset();
+	}
+
+	// Back to the carrier's layout with no peripherals present and no results
+	void reset ()
+	{
+		int i;
+
+		szgCarrierInit<szgCarrier>(&svio);
+
+		for (i = 0; i < SVIO_NUM_PORTS; i++) {
+			dna[i].setLength(0);
+		}
+	}
+
+	// Solve every group with 'method', storing the voltages in
+	// svio.svio_results, 0 for a group without a solution. Groups joined by
+	// doublewide peripherals are solved once and share a voltage. The ports
+	// are solved from a copy with the FPGA side of groups holding an LVDS
+	// peripheral pinned to 2.5 V, so the context can be solved repeatedly.
+	// Returns the number of groups without a solution.
+	int solve (int method)
+	{
+		szgSmartVIOPort ports[SVIO_NUM_PORTS];
+		int host;
+		int i;
+
+		memcpy(ports, svio.ports, sizeof(ports));
+
+		for (i = 0; i < szgCarrier::num_ports; i++) {
+			if (ports[i].present && (ports[i].i2c_addr != 0x00)
+			    && (ports[i].attr & SZG_ATTR_LVDS)) {
+				host = szgCarrierHostPort<szgCarrier>(ports[i].group);
+
+				ports[host].ranges[0].min = 250;
+				ports[host].ranges[0].max = 250;
+			}
+		}
+
+		return szgSolveSmartVIOComponents(ports, svio.group_masks,
+		                                  szgCarrier::num_groups,
+		                                  svio.svio_results, method);
+	}
+
+	szgSmartVIOConfig svio;
+
+	// Full DNA of each port, empty for ports not read
+	szgDNA dna[SVIO_NUM_PORTS];
+};
+
+#endif // SZG_SMARTVIO_HPP
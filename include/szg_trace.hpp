@@ -0,0 +1,293 @@
+// SYZYGY Bus Traces
+//
+// Recording of bus traffic and replay of recorded traces.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+#ifndef SZG_TRACE_HPP
+#define SZG_TRACE_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+#include "szg_sim.hpp"
+
+extern "C" {
+#include "szg_i2c.h"
+}
+
+
+// Trace file written by recording builds when SZG_TRACE_FILE is not set.
+#define SZG_TRACE_DEFAULT_FILE              "szg.trace"
+
+// Bus operations recorded in a trace.
+#define SZG_TRACE_DETECT                    (0)
+#define SZG_TRACE_WRITE                     (1)
+#define SZG_TRACE_READ                      (2)
+#define SZG_TRACE_WRITE_MCU                 (3)
+#define SZG_TRACE_READ_MCU                  (4)
+#define SZG_TRACE_DETECT_READ_MCU           (5)
+#define SZG_TRACE_NUM_OPS                   (6)
+
+
+// One bus operation of a trace. A trace is a text file starting with a
+// "# szg-trace 1" line, followed by one operation per line:
+//
+//   <start us> <duration us> <transactions> <op> <addr> <sub-address>
+//   <sub-address length> <length> <result> <hex payload or ->
+//
+// Times are relative to the moment the bus was opened. The payload holds
+// the data written, or the data returned by a successful read. A result
+// other than 0 records a NAK or a failed transfer.
+typedef struct {
+	uint64_t             t_us;
+	uint64_t             dur_us;
+	unsigned long        transactions;
+	int                  op;
+	int                  addr;
+	int                  sub_addr;
+	int                  sub_addr_length;
+	int                  length;
+	int                  result;
+	std::vector<uint8_t> data;
+} szgTraceRecord;
+
+
+void szgTraceWrite(FILE *f, const szgTraceRecord &rec, const uint8_t *data);
+
+int szgTraceLoad(const char *filename, std::vector<szgTraceRecord> &records);
+
+
+// Bus policy wrapping another backend and logging each of its operations,
+// with timing, transaction counts, payloads and results, to the file named
+// by the SZG_TRACE_FILE environment variable.
+template <class Inner>
+class szgRecordBus {
+public:
+	szgRecordBus () : trace(NULL), start_us(0) {}
+
+	int open (const char *name)
+	{
+		const char *filename = getenv("SZG_TRACE_FILE");
+
+		if (filename == NULL) {
+			filename = SZG_TRACE_DEFAULT_FILE;
+		}
+
+		trace = fopen(filename, "w");
+		if (trace == NULL) {
+			return -1;
+		}
+		fprintf(trace, "# szg-trace 1 %s\n", name);
+
+		start_us = szgI2CTimeUs();
+		return inner.open(name);
+	}
+
+	void close ()
+	{
+		inner.close();
+		if (trace != NULL) {
+			fclose(trace);
+			trace = NULL;
+		}
+	}
+
+	int i2cDetect (int i2c_addr)
+	{
+		szgTraceRecord rec = begin(SZG_TRACE_DETECT, i2c_addr, 0, 0, 0);
+
+		rec.result = inner.i2cDetect(i2c_addr);
+		end(rec, NULL);
+		return rec.result;
+	}
+
+	int i2cWrite (int i2c_addr, uint16_t sub_addr, int sub_addr_length,
+	              int length, const uint8_t *data)
+	{
+		szgTraceRecord rec = begin(SZG_TRACE_WRITE, i2c_addr, sub_addr,
+		                           sub_addr_length, length);
+
+		rec.result = inner.i2cWrite(i2c_addr, sub_addr, sub_addr_length,
+		                            length, data);
+		end(rec, data);
+		return rec.result;
+	}
+
+	int i2cRead (int i2c_addr, uint16_t sub_addr, int sub_addr_length,
+	             int length, uint8_t *data)
+	{
+		szgTraceRecord rec = begin(SZG_TRACE_READ, i2c_addr, sub_addr,
+		                           sub_addr_length, length);
+
+		rec.result = inner.i2cRead(i2c_addr, sub_addr, sub_addr_length,
+		                           length, data);
+		end(rec, (rec.result == 0) ? data : NULL);
+		return rec.result;
+	}
+
+	int writeMCU (uint16_t port_addr, int sub_addr, const uint8_t *data,
+	              int length)
+	{
+		szgTraceRecord rec = begin(SZG_TRACE_WRITE_MCU, port_addr, sub_addr,
+		                           2, length);
+
+		rec.result = inner.writeMCU(port_addr, sub_addr, data, length);
+		end(rec, data);
+		return rec.result;
+	}
+
+	int readMCU (uint16_t port_addr, int sub_addr, uint8_t *data, int length)
+	{
+		szgTraceRecord rec = begin(SZG_TRACE_READ_MCU, port_addr, sub_addr,
+		                           2, length);
+
+		rec.result = inner.readMCU(port_addr, sub_addr, data, length);
+		end(rec, (rec.result == 0) ? data : NULL);
+		return rec.result;
+	}
+
+	int detectReadMCU (uint16_t port_addr, int sub_addr, uint8_t *data,
+	                   int length)
+	{
+		szgTraceRecord rec = begin(SZG_TRACE_DETECT_READ_MCU, port_addr,
+		                           sub_addr, 2, length);
+
+		rec.result = inner.detectReadMCU(port_addr, sub_addr, data, length);
+		end(rec, (rec.result == 0) ? data : NULL);
+		return rec.result;
+	}
+
+	int setChunkLength (int i2c_addr, int length)
+	{
+		return inner.setChunkLength(i2c_addr, length);
+	}
+
+	int setPageSize (int i2c_addr, int page_size)
+	{
+		return inner.setPageSize(i2c_addr, page_size);
+	}
+
+	int writeCycleUs (int i2c_addr)
+	{
+		return inner.writeCycleUs(i2c_addr);
+	}
+
+	unsigned long transactions ()
+	{
+		return inner.transactions();
+	}
+
+	uint64_t timeUs ()
+	{
+		return inner.timeUs();
+	}
+
+private:
+	szgTraceRecord begin (int op, int addr, int sub_addr, int sub_addr_length,
+	                      int length)
+	{
+		szgTraceRecord rec;
+
+		rec.t_us = szgI2CTimeUs();
+		rec.transactions = inner.transactions();
+		rec.op = op;
+		rec.addr = addr;
+		rec.sub_addr = sub_addr;
+		rec.sub_addr_length = sub_addr_length;
+		rec.length = length;
+		rec.result = 0;
+		return rec;
+	}
+
+	void end (szgTraceRecord &rec, const uint8_t *data)
+	{
+		uint64_t now_us = szgI2CTimeUs();
+
+		rec.dur_us = now_us - rec.t_us;
+		rec.t_us -= start_us;
+		rec.transactions = inner.transactions() - rec.transactions;
+		if (trace != NULL) {
+			szgTraceWrite(trace, rec, data);
+		}
+	}
+
+	Inner    inner;
+	FILE    *trace;
+	uint64_t start_us;
+};
+
+
+// Bus policy replaying a recorded trace. The carrier is rebuilt in an
+// szgSimBus from the trace: devices that answered are present, and the
+// bytes they returned populate their memory. The simulator's timing model is
+// calibrated against the recorded durations. Operations matching the
+// recording are charged their recorded duration. Matching realigns past
+// operations the run adds, drops or reorders, and any operation left without a match
+// is charged by the calibrated model. On close, the transaction count and
+// bus time of this run are reported against the recording, along with the
+// recorded operations not issued and the new ones.
+class szgReplayBus {
+public:
+	szgReplayBus ();
+
+	int open (const char *name);
+	void close ();
+
+	int i2cDetect (int i2c_addr);
+	int i2cWrite (int i2c_addr, uint16_t sub_addr, int sub_addr_length,
+	              int length, const uint8_t *data);
+	int i2cRead (int i2c_addr, uint16_t sub_addr, int sub_addr_length,
+	             int length, uint8_t *data);
+	int writeMCU (uint16_t port_addr, int sub_addr, const uint8_t *data,
+	              int length);
+	int readMCU (uint16_t port_addr, int sub_addr, uint8_t *data, int length);
+	int detectReadMCU (uint16_t port_addr, int sub_addr, uint8_t *data,
+	                   int length);
+	int setChunkLength (int i2c_addr, int length);
+	int setPageSize (int i2c_addr, int page_size);
+	int writeCycleUs (int i2c_addr);
+	unsigned long transactions ();
+	uint64_t timeUs ();
+
+	// Prints the comparison of this run against the recording to stderr.
+	void report ();
+
+private:
+	void calibrate ();
+	size_t find (size_t from, size_t to, int op, int addr, int sub_addr) const;
+	void charge (int op, int addr, int sub_addr, int length, uint64_t t0_ns);
+
+	szgSimBus                    sim;
+	std::vector<szgTraceRecord>  records;
+	std::vector<char>            used;
+	size_t                       cursor;
+	unsigned long                ops;
+	unsigned long                matched;
+	uint64_t                     time_ns;
+};
+
+#endif // SZG_TRACE_HPP
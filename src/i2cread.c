@@ -1,17 +1,17 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <fcntl.h>
+#include <stdint.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
+
+#include "szg_i2c.h"
 
 int main (int argc, char *argv[])
 {
-	int file;
+	szgI2CBus bus;
 	int error = 0;
 	int addr = 0;
-	char buf[2];
+	uint16_t sub_addr;
+	uint8_t buf[1];
 
 	char filename[20];
 
@@ -21,33 +21,22 @@ int main (int argc, char *argv[])
 	}
 
 	snprintf(filename,19,"/dev/i2c-%d", atoi(argv[1]));
-	file = open(filename, O_RDWR);
-	if (file < 0) {
+	if (szgI2COpen(&bus, filename) != 0) {
 		printf("Error opening device\n");
 		exit(1);
 	}
 
 	addr = strtoul(argv[2], NULL, 16);
+	sub_addr = strtoul(argv[3], NULL, 16) & 0xFFFF;
 
-	if (ioctl(file, I2C_SLAVE, addr) < 0) {
-		printf("Error during address set\n");
-		exit(1);
-	}
-
-	buf[0] = (strtoul(argv[3], NULL, 16) >> 8) & 0xFF;
-	buf[1] = (strtoul(argv[3], NULL, 16)) & 0xFF;
-
-	if (write(file,buf,2) != 2) {
-		printf("Error during write\n");
-		exit(1);
-	}
-
-	if (read(file,buf,1) != 1) {
+	if (i2cRead(&bus, addr, sub_addr, 2, 1, buf) != 0) {
 		printf("Error during read\n");
 		exit(1);
 	} else {
 		printf("Result: %.2X\n", buf[0]);
 	}
 
+	szgI2CClose(&bus);
+
 	return error;
 }
@@ -37,158 +37,20 @@
 #include <argp.h>
 #include <fcntl.h>
 #include <getopt.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
+
+#include "szg_bus.hpp"
 
 using json = nlohmann::json;
 
-#define I2C_CHECK_COUNT 2000
 #define SEQ_LENGTH 9
 
 
-// Detect if a device is on a given I2C address, returns 0 if present
-int i2cDetect (int i2c_file, int i2c_addr)
-{
-	uint8_t data[2];
-
-	// Set I2C address
-	if (ioctl(i2c_file, I2C_SLAVE, i2c_addr) < 0) {
-		return -1;
-	}
-
-	data[0] = 0x00;
-	data[1] = 0x00;
-
-	if (write(i2c_file, data, 2) != 2) {
-		return 1; // I2C device not present
-	}
-
-	return 0; // I2C device present
-}
-
-
-// Write to I2C with either a 16- or 8-bit address
-int i2cWrite (int i2c_file, int i2c_addr, uint16_t sub_addr,
-              int sub_addr_length, int length, uint8_t data[32])
-{
-	uint8_t *buffer = (uint8_t *)malloc((length * sizeof(uint8_t)) + sub_addr_length);
-	int i;
-
-	memcpy(buffer + sub_addr_length, data, length * sizeof(uint8_t));
-
-	// Set I2C address
-	if (ioctl(i2c_file, I2C_SLAVE, i2c_addr) < 0) {
-		return -1;
-	}
-
-	if (sub_addr_length == 2) {
-		buffer[0] = (sub_addr >> 8) & 0xFF;
-		buffer[1] = sub_addr & 0xFF;
-	} else {
-		buffer[0] = sub_addr & 0xFF;
-	}
-
-	for (i = 0; i < I2C_CHECK_COUNT; i++) {
-		// The DNA Spec allows an MCU to NAK subsequent writes when multiple
-		// writes are performed, keep trying for I2C_CHECK_COUNT tries before
-		// giving up.
-		if (write(i2c_file, buffer, sub_addr_length + length)
-		      == (length + sub_addr_length)) {
-			return 0;
-		}
-	}
-
-	// We gave up trying to write
-	return -1;
-}
-
-
-// Read from I2C with either a 16- or 8-bit address
-int i2cRead (int i2c_file, int i2c_addr, uint16_t sub_addr,
-             int sub_addr_length, int length, uint8_t data[32])
-{
-	uint8_t temp_buf[2];
-
-	// Set I2C address
-	if (ioctl(i2c_file, I2C_SLAVE, i2c_addr) < 0) {
-		return -1;
-	}
-
-	if (sub_addr_length == 2) {
-		temp_buf[0] = (sub_addr >> 8) & 0xFF;
-		temp_buf[1] = sub_addr & 0xFF;
-	} else {
-		temp_buf[0] = sub_addr & 0xFF;
-	}
-
-	if (write(i2c_file, temp_buf, sub_addr_length) != sub_addr_length) {
-		return -1;
-	}
-
-	if (read(i2c_file, data, length) != length) {
-		return -1;
-	}
-
-	return 0;
-}
-
-// Helper function that allows for writes > 32 bytes to a SYZYGY MCU
-int writeMCU (int i2c_file, uint16_t port_addr, int sub_addr, uint8_t *data,
-              int length)
-{
-	int temp_length, current_sub_addr;
-
-	// Useful for debug
-	//printf("Writing %d bytes to 0x%X, sub-address 0x%X\n", length, port_addr, sub_addr);
-
-	current_sub_addr = sub_addr;
-
-	while (length > 0) {
-		temp_length = (length > 32) ? 32 : length;
-
-		if (i2cWrite(i2c_file, port_addr, current_sub_addr, 2, temp_length,
-		             &data[(current_sub_addr - sub_addr)]) != 0) {
-			return -1;
-		}
-
-		current_sub_addr += temp_length;
-		length -= temp_length;
-	}
-
-	return 0;
-}
-
-// Helper function that allows for reads > 32 bytes from a SYZYGY MCU
-int readMCU (int i2c_file, uint16_t port_addr, int sub_addr, uint8_t *data,
-             int length)
-{
-	int current_sub_addr, temp_length;
-
-	// Useful for debug
-	//printf("Reading %d bytes from 0x%X, sub-address 0x%X\n", length, port_addr, sub_addr);
-
-	current_sub_addr = sub_addr;
-
-	while (length > 0) {
-		temp_length = (length > 32) ? 32 : length;
-
-		if (i2cRead(i2c_file, port_addr, current_sub_addr, 2, temp_length,
-		            &data[(current_sub_addr - sub_addr)]) != 0) {
-			return -1;
-		}
-
-		current_sub_addr += temp_length;
-		length -= temp_length;
-	}
-
-	return 0;
-}
-
 // Helper function to dump a full sequencer register set, determines the length
 // of the DNA and returns it
-int dumpSeq (int i2c_file, uint16_t port_addr, uint8_t *data)
+template <class Bus>
+int dumpSeq (Bus &bus, uint16_t port_addr, uint8_t *data)
 {
-	if (readMCU(i2c_file, port_addr, 0x9000, data, SEQ_LENGTH) != 0) {
+	if (bus.readMCU(port_addr, 0x9000, data, SEQ_LENGTH) != 0) {
 		return -1;
 	}
 
@@ -227,7 +89,7 @@ int main (int argc, char *argv[])
 	char i2c_filename[200];
 	char seq_filename[200];
 	uint8_t seq_buf[9];
-	int i2c_file;
+	szgBus bus;
 	int seq_file;
 	int periph_num = 0;
 	int curr_opt;
@@ -291,8 +153,7 @@ int main (int argc, char *argv[])
 	}
 
 	// Open I2C file
-	i2c_file = open(i2c_filename, O_RDWR);
-	if (i2c_file < 0) {
+	if (bus.open(i2c_filename) != 0) {
 		printf("Error opening i2c device\n");
 		exit(EXIT_FAILURE);
 	}
@@ -304,7 +165,7 @@ int main (int argc, char *argv[])
 	}
 
 	if ((wflag == 1) || (dflag == 1)) {
-		if (i2cDetect(i2c_file, peripheral_address[periph_num]) != 0) {
+		if (bus.i2cDetect(peripheral_address[periph_num]) != 0) {
 			printf("Peripheral at %X not found\n", peripheral_address[periph_num]);
 			exit(EXIT_FAILURE);
 		}
@@ -322,13 +183,13 @@ int main (int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 
-		if (writeMCU(i2c_file, peripheral_address[periph_num], 0x9000,
-		             seq_buf, SEQ_LENGTH) != 0) {
+		if (bus.writeMCU(peripheral_address[periph_num], 0x9000,
+		                 seq_buf, SEQ_LENGTH) != 0) {
 			printf("Error writing to the MCU\n");
 			exit(EXIT_FAILURE);
 		}
 	} else if (dflag == 1) { // Dump sequencer registers from a peripheral to a file
-		err = dumpSeq(i2c_file, peripheral_address[periph_num], seq_buf);
+		err = dumpSeq(bus, peripheral_address[periph_num], seq_buf);
 
 		if (err < 0) {
 			printf("Error reading sequencer registers from device\n");
@@ -344,6 +205,8 @@ int main (int argc, char *argv[])
 		return 0;
 	}
 
+	bus.close();
+
 	return 0;
 }
 
@@ -35,8 +35,16 @@
 #include <argp.h>
 #include <fcntl.h>
 #include <getopt.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+
+#include "szg_bus.hpp"
+#include "szg_dna.hpp"
+#include "szg_carrier.hpp"
+#include "szg_smartvio.hpp"
 
 extern "C" {
 #include "syzygy.h"
@@ -44,307 +52,867 @@ extern "C" {
 
 using json = nlohmann::json;
 
-#define I2C_CHECK_COUNT 2000
 
-// Brain 1 SmartVIO Characteristics
-// 2 SmartVIO Groups
-// Group 1 has 1 port, FPGA range is 1.2 to 3.3 V
-// Group 2 has 3 ports, FPGA range is 1.2 to 3.3 V
+// The results of groups 1 and 2 drive VIO1 and VIO2
+static_assert(szgCarrier::num_groups <= 2, "smartvio-brain drives at most two VIO rails");
 
-szgSmartVIOConfig svio = {
-	SVIO_NUM_PORTS, SVIO_NUM_GROUPS, {0,0}, {0x1, 0x2}, {
-		{
-			// Group 1
-			0x00, // i2c_addr
-			1,    // present
-			0,    // group
-			0,    // req_ver_major
-			0,    // req_ver_minor
-			0x00, // attr
-			0x00, // port_attr
-			0,    // doublewide_mate
-			1,    // range_count
-			{ {120, 330}, {0,0}, {0,0}, {0,0} } // ranges
-		}, {
-			0x30, // i2c_addr
-			0,    // present
-			0,    // group
-			0,    // req_ver_major
-			0,    // req_ver_minor
-			0x00, // attr
-			0x00, // port_attr
-			0,    // doublewide_mate
-			0,    // range_count
-			{ {0, 0}, {0,0}, {0,0}, {0,0} } // ranges
-		}, {
-			// Group 2
-			0x00, // i2c_addr
-			1,    // present
-			1,    // group
-			0,    // req_ver_major
-			0,    // req_ver_minor
-			0x00, // attr
-			0x00, // port_attr
-			1,    // doublewide_mate
-			1,    // range_count
-			{ {120, 330}, {0,0}, {0,0}, {0,0} } // ranges
-		}, {
-			0x31, // i2c_addr
-			0,    // present
-			1,    // group
-			0,    // req_ver_major
-			0,    // req_ver_minor
-			0x00, // attr
-			0x00, // port_attr
-			1,    // doublewide_mate
-			0,    // range_count
-			{ {0, 0}, {0,0}, {0,0}, {0,0} } // ranges
-		}, {
-			0x32, // i2c_addr
-			0,    // present
-			1,    // group
-			0,    // req_ver_major
-			0,    // req_ver_minor
-			0x00, // attr
-			0x00, // port_attr
-			1,    // doublewide_mate
-			0,    // range_count
-			{ {0, 0}, {0,0}, {0,0}, {0,0} } // ranges
-		}, {
-			0x33, // i2c_addr
-			0,    // present
-			1,    // group
-			0,    // req_ver_major
-			0,    // req_ver_minor
-			0x00, // attr
-			0x00, // port_attr
-			1,    // doublewide_mate
-			0,    // range_count
-			{ {0, 0}, {0,0}, {0,0}, {0,0} } // ranges
-		}
-	}
+// I2C address of the peripheral on port n + 1
+static inline uint16_t peripheralAddress (int n)
+{
+	return szgCarrierPeripheral<szgCarrier>(n);
+}
+
+// SmartVIO solver methods selectable with -S, the first being the default
+const struct {
+	const char *name;
+	int         method;
+} svio_solvers[] = {
+	{ "sweep", SZG_SOLVE_SWEEP },
+	{ "first", SZG_SOLVE_FIRST_FOUND },
+	{ "low", SZG_SOLVE_BITSET_LOW },
+	{ "high", SZG_SOLVE_BITSET_HIGH },
+	{ "center", SZG_SOLVE_BITSET_CENTER },
 };
 
-// Detect if a device is on a given I2C address, returns 0 if present
-int i2cDetect (int i2c_file, int i2c_addr)
-{
-	uint8_t data[2];
 
-	// Set I2C address
-	if (ioctl(i2c_file, I2C_SLAVE, i2c_addr) < 0) {
+// Last known state of a port, as kept in the state file used by -c
+typedef struct {
+	int      present;
+	uint16_t crc;
+} dnaState;
+
+
+// Helper function to dump a full DNA, determines the length of
+// the DNA and returns it
+template <class Bus>
+int dumpDNA (Bus &bus, uint16_t port_addr, szgDNA &dna)
+{
+	// The header carries both the DNA length and the version fields that
+	// determine how long the remaining transfers may be
+	if (bus.readMCU(port_addr, 0x8000, dna.data(), SZG_DNA_HEADER_LENGTH_V1) != 0) {
 		return -1;
 	}
 
-	data[0] = 0x00;
-	data[1] = 0x00;
+	if (dna.fullLength() > SZG_DNA_MAX_LENGTH) {
+		printf("Invalid DNA Length\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bus.setChunkLength(port_addr, szgDNAMaxReadLength(dna.data()));
 
-	if (write(i2c_file, data, 2) != 2) {
-		return 1; // I2C device not present
+	if ((dna.fullLength() > SZG_DNA_HEADER_LENGTH_V1)
+	    && (bus.readMCU(port_addr, 0x8000 + SZG_DNA_HEADER_LENGTH_V1,
+	                    dna.data() + SZG_DNA_HEADER_LENGTH_V1,
+	                    dna.fullLength() - SZG_DNA_HEADER_LENGTH_V1) != 0)) {
+		return -1;
 	}
 
-	return 0; // I2C device present
+	dna.setLength(dna.fullLength());
+
+	return dna.size();
 }
 
 
-// Write to I2C with either a 16- or 8-bit address
-int i2cWrite (int i2c_file, int i2c_addr, uint16_t sub_addr,
-              int sub_addr_length, int length, uint8_t data[32])
-{
-	uint8_t *buffer = (uint8_t *)malloc((length * sizeof(uint8_t)) + sub_addr_length);
-	int i;
+// Clock of the Brain-1 I2C bus, used to plan the transfer time of writes
+#define BRAIN_I2C_BUS_HZ (100000)
 
-	memcpy(buffer + sub_addr_length, data, length * sizeof(uint8_t));
 
-	// Set I2C address
-	if (ioctl(i2c_file, I2C_SLAVE, i2c_addr) < 0) {
-		return -1;
-	}
+// Outcome of a DNA write, see writeDNA
+typedef struct {
+	int      pages;         // pages written
+	int      total_pages;   // pages spanned by the image
+	uint64_t planned_us;    // write time planned from the firmware table and
+	                        // the bus clock
+	uint64_t actual_us;     // write time taken, final write cycle included
+	int      cycle_us;      // write cycle planned from the firmware table
+	int      measured_us;   // write cycle the transport measured, 0 if the
+	                        // device never NAKed a write
+	int      full_readback; // set when a page did not verify and the whole
+	                        // image had to be read back
+} dnaWriteReport;
 
-	if (sub_addr_length == 2) {
-		buffer[0] = (sub_addr >> 8) & 0xFF;
-		buffer[1] = sub_addr & 0xFF;
-	} else {
-		buffer[0] = sub_addr & 0xFF;
+
+// Find the next run of pages flagged in 'dirty', starting the search at
+// '*page'. Returns the number of pages in the run, 0 if none is left.
+static int nextPageRun (const uint8_t *dirty, int num_pages, int *page)
+{
+	int n = 0;
+
+	while ((*page < num_pages) && !dirty[*page]) {
+		(*page)++;
+	}
+	while ((*page + n < num_pages) && dirty[*page + n]) {
+		n++;
 	}
 
-	for (i = 0; i < I2C_CHECK_COUNT; i++) {
-		// The DNA Spec allows an MCU to NAK subsequent writes when multiple
-		// writes are performed, keep trying for I2C_CHECK_COUNT tries before
-		// giving up.
-		if (write(i2c_file, buffer, sub_addr_length + length)
-		      == (length + sub_addr_length)) {
-			return 0;
+	return n;
+}
+
+
+// Write the pages flagged in 'dirty', one writeMCU per run of neighbouring
+// pages, then wait out the write cycle of the last one with an address-only
+// write, which the MCU NAKs until it is done
+template <class Bus>
+int writeDNAPages (Bus &bus, uint16_t port_addr, const uint8_t *data,
+                   int length, int page_size, const uint8_t *dirty)
+{
+	int num_pages = (length + page_size - 1) / page_size;
+	int page, n, offset;
+	int written = 0;
+
+	for (page = 0; (n = nextPageRun(dirty, num_pages, &page)) > 0; page += n) {
+		offset = page * page_size;
+		if (bus.writeMCU(port_addr, 0x8000 + offset, &data[offset],
+		                 szgMIN((page + n) * page_size, length) - offset) != 0) {
+			return -1;
 		}
+		written = 1;
 	}
 
-	// We gave up trying to write
-	return -1;
+	if (written && (bus.i2cWrite(port_addr, 0x8000, 2, 0, data) != 0)) {
+		return -1;
+	}
+
+	return 0;
 }
 
 
-// Read from I2C with either a 16- or 8-bit address
-int i2cRead (int i2c_file, int i2c_addr, uint16_t sub_addr,
-             int sub_addr_length, int length, uint8_t data[32])
+// Write a DNA image to a peripheral, writing only the pages that differ
+// from what the peripheral already holds. Each page written costs the MCU a
+// write cycle, while reading the current image back is comparatively cheap.
+// The page size and write cycle are planned from the firmware table entry
+// for the DNA version of the image.
+//
+// The pages written are read back, one read per run of pages, and
+// compared byte for byte with the image. The firmware keeps no checksum of
+// its own that could be read instead. Only when a page differs, or its read
+// fails, is the whole image read back, the pages still wrong written again,
+// and the image compared once more. Returns 0 on success, -1 on error.
+template <class Bus>
+int writeDNA (Bus &bus, uint16_t port_addr, const uint8_t *data, int length,
+              dnaWriteReport *report)
 {
-	uint8_t temp_buf[2];
+	uint8_t curr_buf[SZG_DNA_MAX_LENGTH];
+	uint8_t dirty[SZG_DNA_MAX_LENGTH];
+	int page_size = SZG_I2C_CHUNK_LENGTH;
+	int write_cycle_us = SZG_DNA_WRITE_CYCLE_US;
+	int num_pages;
+	int page, n, offset, page_length;
+	int verified = 1;
+	int have_curr;
+	uint64_t t0;
+
+	if (length >= SZG_DNA_HEADER_LENGTH_V1) {
+		page_size = szgDNAPageSize(data);
+		write_cycle_us = szgDNAWriteCycleUs(data);
+	}
+	bus.setPageSize(port_addr, page_size);
+
+	num_pages = (length + page_size - 1) / page_size;
+	report->pages = 0;
+	report->total_pages = num_pages;
+	report->planned_us = 0;
+	report->actual_us = 0;
+	report->cycle_us = write_cycle_us;
+	report->measured_us = 0;
+	report->full_readback = 0;
+
+	// Without a readback to compare against, write everything
+	have_curr = (bus.readMCU(port_addr, 0x8000, curr_buf, length) == 0);
+
+	for (page = 0; page < num_pages; page++) {
+		offset = page * page_size;
+		page_length = szgMIN(page_size, length - offset);
+
+		dirty[page] = !have_curr
+		              || (memcmp(&curr_buf[offset], &data[offset], page_length) != 0);
+		if (!dirty[page]) {
+			continue;
+		}
 
-	// Set I2C address
-	if (ioctl(i2c_file, I2C_SLAVE, i2c_addr) < 0) {
+		// One write cycle, plus the address, sub-address and data bytes
+		// with their ACKs and the start and stop conditions
+		report->pages++;
+		report->planned_us += write_cycle_us
+		                      + (uint64_t)((3 + page_length) * 9 + 2)
+		                        * 1000000 / BRAIN_I2C_BUS_HZ;
+	}
+
+	t0 = bus.timeUs();
+	if (writeDNAPages(bus, port_addr, data, length, page_size, dirty) != 0) {
 		return -1;
 	}
+	report->actual_us = bus.timeUs() - t0;
+	report->measured_us = bus.writeCycleUs(port_addr);
+
+	// Read back the written pages and compare them with the image
+	for (page = 0; (n = nextPageRun(dirty, num_pages, &page)) > 0; page += n) {
+		offset = page * page_size;
+		page_length = szgMIN((page + n) * page_size, length) - offset;
+
+		if ((bus.readMCU(port_addr, 0x8000 + offset, &curr_buf[offset],
+		                 page_length) != 0)
+		    || (memcmp(&curr_buf[offset], &data[offset], page_length) != 0)) {
+			verified = 0;
+			break;
+		}
+	}
 
-	if (sub_addr_length == 2) {
-		temp_buf[0] = (sub_addr >> 8) & 0xFF;
-		temp_buf[1] = sub_addr & 0xFF;
-	} else {
-		temp_buf[0] = sub_addr & 0xFF;
+	if (verified) {
+		return 0;
 	}
 
-	if (write(i2c_file, temp_buf, sub_addr_length) != sub_addr_length) {
+	// Find the pages that did not take, and give them one more write
+	report->full_readback = 1;
+	if (bus.readMCU(port_addr, 0x8000, curr_buf, length) != 0) {
 		return -1;
 	}
 
-	if (read(i2c_file, data, length) != length) {
+	for (page = 0; page < num_pages; page++) {
+		offset = page * page_size;
+		page_length = szgMIN(page_size, length - offset);
+		dirty[page] = (memcmp(&curr_buf[offset], &data[offset], page_length) != 0);
+	}
+
+	if (writeDNAPages(bus, port_addr, data, length, page_size, dirty) != 0) {
+		return -1;
+	}
+
+	if ((bus.readMCU(port_addr, 0x8000, curr_buf, length) != 0)
+	    || (memcmp(curr_buf, data, length) != 0)) {
 		return -1;
 	}
 
 	return 0;
 }
 
-// Helper function that allows for writes > 32 bytes to a SYZYGY MCU
-int writeMCU (int i2c_file, uint16_t port_addr, int sub_addr, uint8_t *data,
-              int length)
+
+// One port of a provisioning manifest, see loadManifest
+typedef struct {
+	int  port;          // port number, 1 to 4
+	char filename[200]; // DNA image, or template when a serial is given
+	char serial[256];   // serial number to stamp into the template
+	int  has_serial;
+	char dump[200];     // file to dump the programmed DNA to
+	int  has_dump;
+} manifestEntry;
+
+
+// Ports of a provisioning manifest reached through one i2c adapter
+typedef struct {
+	std::string                device;
+	std::vector<manifestEntry> entries;
+} manifestAdapter;
+
+
+// Load a provisioning manifest, one setting per line:
+//
+//   adapter <i2c device>            ports that follow are on this adapter
+//   port <n> <dna file>             write the file as is to port n
+//   port <n> <dna file> <serial>    write the file to port n with its
+//                                   serial number replaced by <serial>
+//   dump <n> <file>                 once port n, listed above in the same
+//                                   adapter section, is programmed and
+//                                   verified, dump its DNA to the file
+//
+// Ports listed before any adapter line are on 'default_device'. An adapter
+// named more than once, including 'default_device', collects the ports of
+// all its sections, so that each device is driven by a single worker. Blank
+// lines and lines starting with '#' are ignored. Returns 0 on success.
+int loadManifest (const char *filename, const char *default_device,
+                  std::vector<manifestAdapter> &adapters)
 {
-	int temp_length, current_sub_addr;
+	FILE *f;
+	char line[512];
+	char key[64];
+	char device[200];
+	char dump[200];
+	manifestEntry entry;
+	size_t current = 0;
+	size_t i;
+	int port;
+	int fields;
+	int line_num = 0;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		printf("Error opening manifest %s\n", filename);
+		return -1;
+	}
+
+	adapters.resize(1);
+	adapters[0].device = default_device;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		line_num++;
 
-	// Useful for debug
-	//printf("Writing %d bytes to 0x%X, sub-address 0x%X\n", length, port_addr, sub_addr);
+		if ((sscanf(line, "%63s", key) != 1) || (key[0] == '#')) {
+			continue;
+		}
+
+		if ((strcmp(key, "adapter") == 0)
+		    && (sscanf(line, "%*s %199s", device) == 1)) {
+			for (current = 0; current < adapters.size(); current++) {
+				if (adapters[current].device == device) {
+					break;
+				}
+			}
+
+			if (current == adapters.size()) {
+				adapters.resize(adapters.size() + 1);
+				adapters.back().device = device;
+			}
+			continue;
+		}
+
+		if ((strcmp(key, "dump") == 0)
+		    && (sscanf(line, "%*s %d %199s", &port, dump) == 2)) {
+			std::vector<manifestEntry> &entries = adapters[current].entries;
+
+			for (i = entries.size(); i > 0; i--) {
+				if (entries[i - 1].port == port) {
+					break;
+				}
+			}
 
-	current_sub_addr = sub_addr;
+			if (i == 0) {
+				printf("%s:%d: dump of a port not listed before it\n",
+				       filename, line_num);
+				fclose(f);
+				return -1;
+			}
 
-	while (length > 0) {
-		temp_length = (length > 32) ? 32 : length;
+			strcpy(entries[i - 1].dump, dump);
+			entries[i - 1].has_dump = 1;
+			continue;
+		}
 
-		if (i2cWrite(i2c_file, port_addr, current_sub_addr, 2, temp_length,
-		             &data[(current_sub_addr - sub_addr)]) != 0) {
+		fields = sscanf(line, "%*s %d %199s %255s", &entry.port,
+		                entry.filename, entry.serial);
+		if ((strcmp(key, "port") != 0) || (fields < 2)
+		    || (entry.port < 1) || (entry.port > szgCarrierPeripherals<szgCarrier>())) {
+			printf("%s:%d: invalid manifest entry\n", filename, line_num);
+			fclose(f);
 			return -1;
 		}
 
-		current_sub_addr += temp_length;
-		length -= temp_length;
+		entry.has_serial = (fields == 3);
+		entry.has_dump = 0;
+		adapters[current].entries.push_back(entry);
+	}
+
+	fclose(f);
+
+	// Drop the default adapter when every port names its own
+	if (adapters[0].entries.empty() && (adapters.size() > 1)) {
+		adapters.erase(adapters.begin());
 	}
 
 	return 0;
 }
 
-// Helper function that allows for reads > 32 bytes from a SYZYGY MCU
-int readMCU (int i2c_file, uint16_t port_addr, int sub_addr, uint8_t *data,
-             int length)
+
+// Program and verify one manifest entry, and dump the programmed DNA if the
+// entry asks for it, recording the outcome and timing of each step in
+// 'result'. Returns 0 on success, -1 on failure.
+template <class Bus>
+int provisionPort (Bus &bus, const manifestEntry &entry, json &result)
 {
-	int current_sub_addr, temp_length;
+	uint16_t port_addr = peripheralAddress(entry.port - 1);
+	dnaWriteReport report;
+	szgDNA dna;
+	szgDNA dump;
+	uint64_t t0 = bus.timeUs();
+	uint64_t t1;
+	int dna_file;
+
+	result["port"] = entry.port;
+	result["file"] = entry.filename;
+	result["result"] = "error";
 
-	// Useful for debug
-	//printf("Reading %d bytes from 0x%X, sub-address 0x%X\n", length, port_addr, sub_addr);
+	dna_file = open(entry.filename, O_RDONLY);
+	if (dna_file < 0) {
+		result["error"] = "cannot open DNA file";
+		return -1;
+	}
+	dna.setLength(read(dna_file, dna.data(), SZG_DNA_MAX_LENGTH));
+	close(dna_file);
+
+	if (!dna.headerValid() || (dna.fullLength() > dna.size())
+	    || (dna.fullLength() < SZG_DNA_HEADER_LENGTH_V1)) {
+		result["error"] = "invalid DNA file";
+		return -1;
+	}
+	dna.setLength(dna.fullLength());
 
-	current_sub_addr = sub_addr;
+	if (entry.has_serial
+	    && (dna.setSerialNumber(entry.serial, strlen(entry.serial)) != 0)) {
+		result["error"] = "cannot apply serial number";
+		return -1;
+	}
+	result["serial_number"] = dna.serialNumber().str();
 
-	while (length > 0) {
-		temp_length = (length > 32) ? 32 : length;
+	if (bus.i2cDetect(port_addr) != 0) {
+		result["error"] = "peripheral not found";
+		return -1;
+	}
 
-		if (i2cRead(i2c_file, port_addr, current_sub_addr, 2, temp_length,
-		            &data[(current_sub_addr - sub_addr)]) != 0) {
+	if (writeDNA(bus, port_addr, dna.data(), dna.size(), &report) != 0) {
+		result["error"] = "write or verify failed";
+		return -1;
+	}
+
+	if (entry.has_dump) {
+		t1 = bus.timeUs();
+
+		if (dumpDNA(bus, port_addr, dump) < 0) {
+			result["error"] = "dump failed";
+			return -1;
+		}
+
+		dna_file = open(entry.dump, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (dna_file < 0) {
+			result["error"] = "cannot open dump file";
 			return -1;
 		}
+		if (write(dna_file, dump.data(), dump.size()) != dump.size()) {
+			close(dna_file);
+			result["error"] = "cannot write dump file";
+			return -1;
+		}
+		close(dna_file);
 
-		current_sub_addr += temp_length;
-		length -= temp_length;
+		result["dump"] = entry.dump;
+		result["dump_ms"] = (bus.timeUs() - t1) / 1e3;
 	}
 
+	result["result"] = "ok";
+	result["pages_written"] = report.pages;
+	result["pages"] = report.total_pages;
+	result["planned_ms"] = report.planned_us / 1e3;
+	result["write_ms"] = report.actual_us / 1e3;
+	result["write_cycle_ms"] = report.measured_us / 1e3;
+	result["verify"] = report.full_readback ? "readback" : "pages";
+	result["time_ms"] = (bus.timeUs() - t0) / 1e3;
+
 	return 0;
 }
 
-// Helper function to dump a full DNA, determines the length of
-// the DNA and returns it
-int dumpDNA (int i2c_file, uint16_t port_addr, uint8_t *data)
+
+// Progress and results of a provisioning run, shared by the adapter
+// workers. Each port is reported as it completes; reports are serialized
+// by a mutex and echoed to stderr as progress lines.
+class provisionCollector {
+public:
+	provisionCollector (size_t total) : total(total), done(0), failed(0) {}
+
+	void report (const std::string &device, const json &result)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		done++;
+		if (result["result"] != "ok") {
+			failed++;
+		}
+
+		fprintf(stderr, "provision: %zu/%zu %s port %d %s\n", done, total,
+		        device.c_str(), result["port"].get<int>(),
+		        result["result"].get<std::string>().c_str());
+	}
+
+	int failures ()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		return failed;
+	}
+
+private:
+	std::mutex lock;
+	size_t     total;
+	size_t     done;
+	int        failed;
+};
+
+
+// Provision every port of a manifest adapter on one open bus, returns the
+// number of ports that failed
+template <class Bus>
+int provisionManifest (Bus &bus, const manifestAdapter &adapter,
+                       provisionCollector &collector, json &results)
 {
-	uint16_t dna_length;
+	uint64_t t0 = bus.timeUs();
+	int failed = 0;
+	size_t i;
 
-	if (i2cRead(i2c_file, port_addr, 0x8000, 2, 2, (uint8_t *)&dna_length) != 0) {
-		return -1;
+	for (i = 0; i < adapter.entries.size(); i++) {
+		if (provisionPort(bus, adapter.entries[i], results["port"][i]) != 0) {
+			failed++;
+		}
+		collector.report(adapter.device, results["port"][i]);
 	}
 
-	if (dna_length > 1318) {
-		printf("Invalid DNA Length\n");
-		exit(EXIT_FAILURE);
+	results["failed"] = failed;
+	results["time_ms"] = (bus.timeUs() - t0) / 1e3;
+
+	return failed;
+}
+
+
+// Worker provisioning the ports of one adapter, on 'bus' if it is already
+// open or on a bus of its own otherwise
+template <class Bus>
+void provisionWorker (Bus *bus, const manifestAdapter *adapter,
+                      provisionCollector *collector, json *results)
+{
+	Bus *own = NULL;
+	size_t i;
+
+	(*results)["device"] = adapter->device;
+
+	if (bus == NULL) {
+		own = new Bus;
+		if (own->open(adapter->device.c_str()) != 0) {
+			for (i = 0; i < adapter->entries.size(); i++) {
+				json &result = (*results)["port"][i];
+
+				result["port"] = adapter->entries[i].port;
+				result["file"] = adapter->entries[i].filename;
+				result["result"] = "error";
+				result["error"] = "cannot open i2c device";
+				collector->report(adapter->device, result);
+			}
+			(*results)["failed"] = adapter->entries.size();
+			delete own;
+			return;
+		}
+		bus = own;
+	}
+
+	provisionManifest(*bus, *adapter, *collector, *results);
+
+	if (own != NULL) {
+		own->close();
+		delete own;
+	}
+}
+
+
+// Provision the ports of all adapters concurrently, one worker thread per
+// adapter. 'bus' is the open bus of 'default_device', handed to the worker
+// of that adapter. A single adapter is reported in the format of
+// provisionManifest, several as an "adapter" array of such reports with the
+// total failures and the time of the slowest adapter. Returns the number of
+// ports that failed.
+template <class Bus>
+int provisionAdapters (Bus &bus, const char *default_device,
+                       const std::vector<manifestAdapter> &adapters,
+                       json &results)
+{
+	std::vector<std::thread> workers;
+	std::vector<json> adapter_results(adapters.size());
+	size_t total = 0;
+	double time_ms = 0;
+	size_t i;
+
+	for (i = 0; i < adapters.size(); i++) {
+		total += adapters[i].entries.size();
 	}
 
-	if (readMCU(i2c_file, port_addr, 0x8000, data, dna_length) != 0) {
+	provisionCollector collector(total);
+
+	if ((adapters.size() == 1) && (adapters[0].device == default_device)) {
+		return provisionManifest(bus, adapters[0], collector, results);
+	}
+
+	for (i = 0; i < adapters.size(); i++) {
+		workers.push_back(std::thread(provisionWorker<Bus>,
+		                              (adapters[i].device == default_device) ? &bus : NULL,
+		                              &adapters[i], &collector, &adapter_results[i]));
+	}
+
+	for (i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+
+	for (i = 0; i < adapters.size(); i++) {
+		results["adapter"][i] = adapter_results[i];
+		if (adapter_results[i].count("time_ms")) {
+			time_ms = szgMAX(time_ms, adapter_results[i]["time_ms"].get<double>());
+		}
+	}
+
+	results["failed"] = collector.failures();
+	results["time_ms"] = time_ms;
+
+	return collector.failures();
+}
+
+
+// Complete 'dna', whose header has been read, from the cache entry of the
+// port if the entry has the same header and serial number. Only the serial
+// number is read from the peripheral. Returns 1 on a hit, 0 on a miss and
+// -1 on a bus error.
+template <class Bus>
+int readCachedDNA (Bus &bus, const szgDNACache &cache, int i2c_addr, szgDNA &dna)
+{
+	szgDNA cached;
+	int serial_offset = dna.stringOffset(4);
+	int serial_length = dna.data()[SZG_DNA_SERIAL_NUMBER_LENGTH];
+
+	if (cache.load(i2c_addr, cached) != 0) {
+		return 0;
+	}
+
+	if (memcmp(cached.data(), dna.data(), SZG_DNA_HEADER_LENGTH_V1) != 0) {
+		return 0;
+	}
+
+	if ((serial_length > 0)
+	    && (bus.readMCU(i2c_addr, 0x8000 + serial_offset,
+	                    dna.data() + serial_offset, serial_length) != 0)) {
 		return -1;
 	}
 
-	return dna_length;
+	if (memcmp(cached.data() + serial_offset, dna.data() + serial_offset,
+	           serial_length) != 0) {
+		return 0;
+	}
+
+	memcpy(dna.data(), cached.data(), cached.size());
+	dna.setLength(cached.size());
+
+	return 1;
 }
 
 
-// Read DNA and determine a SmartVIO solution, stored in 'svio1' and 'svio2'
-int readDNA (int i2c_file, uint32_t *svio1, uint32_t *svio2)
+// Reset 'ctx', read the DNA of every port into it and determine a SmartVIO
+// solution with solver 'method', stored in 'svio1' and 'svio2'. Strings are
+// served from 'cache' for peripherals it already knows.
+template <class Bus>
+int readDNA (Bus &bus, szgSmartVIOContext &ctx, const szgDNACache &cache,
+             int method, uint32_t *svio1, uint32_t *svio2)
 {
+	szgSmartVIOConfig &svio = ctx.svio;
 	uint8_t i;
-	int vmin;
-	uint8_t dna_buf[64];
+	int err;
+	int dna_length;
 
-	for (i = 0; i < SVIO_NUM_PORTS; i++) {
+	ctx.reset();
+
+	for (i = 0; i < szgCarrier::num_ports; i++) {
 		// Skip ports referring to the FPGA
 		if (0x00 == svio.ports[i].i2c_addr) {
 			continue;
 		}
 
-		if (i2cDetect(i2c_file, svio.ports[i].i2c_addr) != 0) {
+		szgDNA &dna = ctx.dna[i];
+
+		// Detect the device and read the full DNA Header in one transfer
+		err = bus.detectReadMCU(svio.ports[i].i2c_addr, 0x8000, dna.data(),
+		                        SZG_DNA_HEADER_LENGTH_V1);
+		if (err > 0) {
 			// Device is not present
+			cache.invalidate(svio.ports[i].i2c_addr);
 			continue;
+		} else if (err < 0) {
+			return -1;
 		}
 
-		// Read the full DNA Header
-		if (readMCU(i2c_file, svio.ports[i].i2c_addr, 0x8000, dna_buf,
-		            SZG_DNA_HEADER_LENGTH_V1) != 0) {
+		dna.setLength(SZG_DNA_HEADER_LENGTH_V1);
+
+		if (dna.parse(i, &svio) != 0) {
 			return -1;
 		}
 
-		if (szgParsePortDNA(i, &svio, dna_buf, SZG_DNA_HEADER_LENGTH_V1) != 0) {
+		// Use the longest transfers the peripheral firmware advertises
+		if (bus.setChunkLength(svio.ports[i].i2c_addr,
+		                       szgDNAMaxReadLength(dna.data())) < 0) {
 			return -1;
 		}
 
-		if (svio.ports[i].attr & SZG_ATTR_LVDS) {
-			switch (svio.ports[i].group) {
-				case 0:
-					svio.ports[0].ranges[0].min = 250;
-					svio.ports[0].ranges[0].max = 250;
-					break;
-				case 1:
-					svio.ports[2].ranges[0].min = 250;
-					svio.ports[2].ranges[0].max = 250;
-					break;
-			}
+		// Fetch the rest of the DNA in one bulk read, unless the cache
+		// already holds it. The length field covers the whole DNA, but
+		// never read less than the strings.
+		err = readCachedDNA(bus, cache, svio.ports[i].i2c_addr, dna);
+		if (err < 0) {
+			return -1;
+		}
+
+		dna_length = szgMAX(dna.fullLength(), dna.stringsEnd());
+		dna_length = szgMIN(dna_length, SZG_DNA_MAX_LENGTH);
+
+		if ((err == 0) && (dna_length > SZG_DNA_HEADER_LENGTH_V1)
+		    && (bus.readMCU(svio.ports[i].i2c_addr,
+		                    0x8000 + SZG_DNA_HEADER_LENGTH_V1,
+		                    dna.data() + SZG_DNA_HEADER_LENGTH_V1,
+		                    dna_length - SZG_DNA_HEADER_LENGTH_V1) != 0)) {
+			return -1;
+		}
+
+		if (err == 0) {
+			dna.setLength(dna_length);
+
+			// Replaces any stale entry for the port
+			cache.store(svio.ports[i].i2c_addr, dna);
 		}
 	}
 
 	// Find a solution
-	for (i = 0; i < SVIO_NUM_GROUPS; i++) {
-		vmin = szgSolveSmartVIOGroup(svio.ports, svio.group_masks[i]);
-		if (vmin > 0) {
-			svio.svio_results[i] = vmin;
+	ctx.solve(method);
+
+	// A carrier with a single group leaves VIO2 alone
+	*svio1 = svio.svio_results[0];
+	*svio2 = (szgCarrier::num_groups > 1) ? svio.svio_results[1] : 0;
+
+	return 0;
+}
+
+
+// Load the last known port states from 'filename'. A missing or unreadable
+// file leaves every port unknown, so that all of them are reported changed.
+// Returns 1 if a state was loaded, 0 otherwise.
+int loadDNAState (const char *filename, dnaState *state, int *known)
+{
+	FILE *f;
+	char line[80];
+	unsigned int addr, present, crc;
+	int i;
+	int loaded = 0;
+
+	for (i = 0; i < szgCarrier::num_ports; i++) {
+		known[i] = 0;
+	}
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%x %u %x", &addr, &present, &crc) != 3) {
+			continue;
+		}
+
+		for (i = 0; i < szgCarrier::num_ports; i++) {
+			if ((szgCarrier::port(i).i2c_addr != 0x00)
+			    && ((unsigned int)szgCarrier::port(i).i2c_addr == addr)) {
+				state[i].present = present;
+				state[i].crc = crc;
+				known[i] = 1;
+				loaded = 1;
+			}
 		}
 	}
 
-	*svio1 = svio.svio_results[0];
-	*svio2 = svio.svio_results[1];
+	fclose(f);
+
+	return loaded;
+}
+
+
+// Store the port states to 'filename', replacing it atomically
+int saveDNAState (const char *filename, const dnaState *state)
+{
+	char tmp_filename[256];
+	FILE *f;
+	int fd;
+	int i;
+
+	if (strlen(filename) + 8 > sizeof(tmp_filename)) {
+		return -1;
+	}
+
+	// A unique temporary file lets several -c runs save at once, the last
+	// rename wins
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.XXXXXX", filename);
+
+	fd = mkstemp(tmp_filename);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if ((fchmod(fd, 0644) != 0) || ((f = fdopen(fd, "w")) == NULL)) {
+		close(fd);
+		unlink(tmp_filename);
+		return -1;
+	}
+
+	fprintf(f, "# szg-dna-state 1\n");
+	for (i = 0; i < szgCarrier::num_ports; i++) {
+		if (szgCarrier::port(i).i2c_addr == 0x00) {
+			continue;
+		}
+
+		fprintf(f, "0x%02X %d 0x%04X\n", szgCarrier::port(i).i2c_addr,
+		        state[i].present, state[i].crc);
+	}
+
+	if ((fflush(f) != 0) || (fsync(fileno(f)) != 0)) {
+		fclose(f);
+		unlink(tmp_filename);
+		return -1;
+	}
+	fclose(f);
+
+	if (rename(tmp_filename, filename) != 0) {
+		unlink(tmp_filename);
+		return -1;
+	}
 
 	return 0;
 }
 
 
+// Check which ports changed since 'state' was taken, reading only the
+// header CRC of each present peripheral. 'changed' is set for ports that
+// need a full DNA read and 'state' is updated to the current contents.
+// Returns the number of changed ports, or -1 on a bus error.
+//
+// The header CRC does not cover the strings, so two peripherals differing
+// only in string contents of the same lengths look the same here.
+template <class Bus>
+int checkDNA (Bus &bus, dnaState *state, const int *known, int *changed)
+{
+	uint8_t crc_buf[2];
+	dnaState curr;
+	int err;
+	int i;
+	int n = 0;
+
+	for (i = 0; i < szgCarrier::num_ports; i++) {
+		changed[i] = 0;
+
+		// Skip ports referring to the FPGA
+		if (0x00 == szgCarrier::port(i).i2c_addr) {
+			continue;
+		}
+
+		err = bus.detectReadMCU(szgCarrier::port(i).i2c_addr,
+		                        0x8000 + SZG_DNA_CRC16_HIGH, crc_buf, 2);
+		if (err < 0) {
+			return -1;
+		}
+
+		curr.present = (err == 0);
+		curr.crc = curr.present ? ((crc_buf[0] << 8) | crc_buf[1]) : 0;
+
+		if (!known[i] || (curr.present != state[i].present)
+		    || (curr.crc != state[i].crc)) {
+			changed[i] = 1;
+			n++;
+		}
+
+		state[i] = curr;
+	}
+
+	return n;
+}
+
+
 // Apply SmartVIO settings to power IC
-int applyVIO (int i2c_file, uint32_t svio1, uint32_t svio2)
+template <class Bus>
+int applyVIO (Bus &bus, uint32_t svio1, uint32_t svio2)
 {
 	uint8_t temp_data[2];
 	
@@ -360,7 +928,7 @@ int applyVIO (int i2c_file, uint32_t svio1, uint32_t svio2)
 
 	// Disable write protect on TPS65400
 	temp_data[0] = 0x20;
-	if (i2cWrite(i2c_file, 0x6a, 0x10, 1, 1, temp_data) != 0) {
+	if (bus.i2cWrite(0x6a, 0x10, 1, 1, temp_data) != 0) {
 		return -1;
 	}
 
@@ -368,22 +936,22 @@ int applyVIO (int i2c_file, uint32_t svio1, uint32_t svio2)
 	if (svio1 != 0) {
 		printf("Setting VIO1 to: %d\n", svio1);
 		temp_data[0] = 0x0;
-		if (i2cWrite(i2c_file, 0x6a, 0x00, 1, 1, temp_data) != 0) {
+		if (bus.i2cWrite(0x6a, 0x00, 1, 1, temp_data) != 0) {
 			return -1;
 		}
 		temp_data[0] = svio1 * 531 / 1000 - 60;
-		if (i2cWrite(i2c_file, 0x6a, 0xd8, 1, 1, temp_data) != 0) {
+		if (bus.i2cWrite(0x6a, 0xd8, 1, 1, temp_data) != 0) {
 			return -1;
 		}
 	}
 	if (svio2 != 0) {
 		printf("Setting VIO2 to: %d\n", svio2);
 		temp_data[0] = 0x1;
-		if (i2cWrite(i2c_file, 0x6a, 0x00, 1, 1, temp_data) != 0) {
+		if (bus.i2cWrite(0x6a, 0x00, 1, 1, temp_data) != 0) {
 			return -1;
 		}
 		temp_data[0] = svio2 * 531 / 1000 - 60;
-		if (i2cWrite(i2c_file, 0x6a, 0xd8, 1, 1, temp_data) != 0) {
+		if (bus.i2cWrite(0x6a, 0xd8, 1, 1, temp_data) != 0) {
 			return -1;
 		}
 	}
@@ -392,14 +960,16 @@ int applyVIO (int i2c_file, uint32_t svio1, uint32_t svio2)
 }
 
 
-// Print strings, Read DNA must have been run first to populate the svio struct
-int printVIOStrings (json &json_handler, int i2c_file)
+// Print strings, Read DNA must have been run first to populate 'ctx' with the
+// DNA of each present port
+int printVIOStrings (const szgSmartVIOContext &ctx, json &json_handler)
 {
-	uint8_t temp_string[257];
+	const szgSmartVIOConfig &svio = ctx.svio;
+	szgDNAString str;
 	int i;
 	int j = 0;
 
-	for (i = 0; i < SVIO_NUM_PORTS; i++) {
+	for (i = 0; i < szgCarrier::num_ports; i++) {
 		if (svio.ports[i].i2c_addr == 0x00) {
 			// don't print anything for FPGA "ports"
 			continue;
@@ -415,79 +985,47 @@ int printVIOStrings (json &json_handler, int i2c_file)
 			continue;
 		}
 
-		// retrieve manufacturer
-		if (readMCU(i2c_file, svio.ports[i].i2c_addr,
-		        0x8000 + svio.ports[i].mfr_offset, temp_string,
-		        svio.ports[i].mfr_length) != 0) {
-			return -1;
-		}
-
-		temp_string[svio.ports[i].mfr_length] = '\0';
+		const szgDNA &dna = ctx.dna[i];
 
+		// manufacturer
+		str = dna.manufacturer();
 		if (!json_handler.is_null()) {
-			json_handler["port"][j]["manufacturer"] = std::string((char*) temp_string);
+			json_handler["port"][j]["manufacturer"] = str.str();
 		} else {
-			printf("Port 0x%X Manufacturer: %s\n", svio.ports[i].i2c_addr, temp_string);
-		}
-
-		// retrieve product name
-		if (readMCU(i2c_file, svio.ports[i].i2c_addr,
-		        0x8000 + svio.ports[i].product_name_offset, temp_string,
-		        svio.ports[i].product_name_length) != 0) {
-			return -1;
+			printf("Port 0x%X Manufacturer: %.*s\n", svio.ports[i].i2c_addr,
+			       str.length, str.data);
 		}
 
-		temp_string[svio.ports[i].product_name_length] = '\0';
-
+		// product name
+		str = dna.productName();
 		if (!json_handler.is_null()) {
-			json_handler["port"][j]["product_name"] = std::string((char*) temp_string);
+			json_handler["port"][j]["product_name"] = str.str();
 		} else {
-			printf("Product Name: %s\n", temp_string);
+			printf("Product Name: %.*s\n", str.length, str.data);
 		}
 
-		// retrieve product model
-		if (readMCU(i2c_file, svio.ports[i].i2c_addr,
-		        0x8000 + svio.ports[i].product_model_offset, temp_string,
-		        svio.ports[i].product_model_length) != 0) {
-			return -1;
-		}
-
-		temp_string[svio.ports[i].product_model_length] = '\0';
-
+		// product model
+		str = dna.productModel();
 		if (!json_handler.is_null()) {
-			json_handler["port"][j]["product_model"] = std::string((char*) temp_string);
+			json_handler["port"][j]["product_model"] = str.str();
 		} else {
-			printf("Product Model: %s\n", temp_string);
+			printf("Product Model: %.*s\n", str.length, str.data);
 		}
 
-		// retrieve product version
-		if (readMCU(i2c_file, svio.ports[i].i2c_addr,
-		        0x8000 + svio.ports[i].product_version_offset, temp_string,
-		        svio.ports[i].product_version_length) != 0) {
-			return -1;
-		}
-
-		temp_string[svio.ports[i].product_version_length] = '\0';
-
+		// product version
+		str = dna.productVersion();
 		if (!json_handler.is_null()) {
-			json_handler["port"][j]["product_version"] = std::string((char*) temp_string);
+			json_handler["port"][j]["product_version"] = str.str();
 		} else {
-			printf("Version: %s\n", temp_string);
+			printf("Version: %.*s\n", str.length, str.data);
 		}
 
-		// retrieve serial
-		if (readMCU(i2c_file, svio.ports[i].i2c_addr,
-		        0x8000 + svio.ports[i].serial_number_offset, temp_string,
-		        svio.ports[i].serial_number_length) != 0) {
-			return -1;
-		}
-
-		temp_string[svio.ports[i].serial_number_length] = '\0';
-
+		// serial
+		str = dna.serialNumber();
 		if (!json_handler.is_null()) {
-			json_handler["port"][j]["serial_number"] = std::string((char*) temp_string);
+			json_handler["port"][j]["serial_number"] = str.str();
 		} else {
-			printf("Serial: %s\n", temp_string);
+			printf("Serial: %.*s\n", str.length, str.data);
 		}
 		j++;
 	}
@@ -512,18 +1050,42 @@ void printHelp (char *progname)
 	printf("                    as an argument\n");
 	printf("    -d <filename> - dump the DNA from a peripheral to a binary file, takes the\n");
 	printf("                    DNA filename as an argument\n");
+	printf("    -m <filename> - program and verify the peripherals listed in a manifest,\n");
+	printf("                    one 'port <n> <dna file> [serial]' line each, and print\n");
+	printf("                    the results as JSON. Ports following an\n");
+	printf("                    'adapter <i2c device>' line are on that adapter, each\n");
+	printf("                    adapter being programmed concurrently. A 'dump <n> <file>'\n");
+	printf("                    line after a port dumps its programmed DNA to the file\n");
+	printf("    -c <filename> - check which peripherals changed since the state stored in\n");
+	printf("                    the given file by reading only their DNA header CRC, then\n");
+	printf("                    update the file\n");
 	printf("\n");
 	printf("  The following options may be used in conjunction with the above options:\n");
 	printf("    -1 <vio1> - Sets the voltage for VIO1\n");
 	printf("    -2 <vio2> - Sets the voltage for VIO2\n");
 	printf("          <vio1> and <vio2> must be specified as numbers in 10's of mV\n");
 	printf("    -p <number> - Specifies the peripheral number for the -w or -d options\n");
+	printf("    -S <solver> - SmartVIO solver for -r and -j: 'sweep' (default) picks the\n");
+	printf("                  lowest voltage every peripheral supports, 'first' the\n");
+	printf("                  first solution found by the original combination search,\n");
+	printf("                  'low', 'high' and 'center' intersect voltage bitmaps and\n");
+	printf("                  pick the lowest, highest or the middle of the widest run\n");
+	printf("    -n - don't use the DNA cache for -r and -j, the cache is kept in\n");
+#if SZG_BUS_DEFAULT_DNA_CACHE
+	printf("         $SZG_DNA_CACHE_DIR, by default %s\n", SZG_DNA_CACHE_DEFAULT_DIR);
+#else
+	printf("         $SZG_DNA_CACHE_DIR, this build uses no cache when it is unset\n");
+#endif
 	printf("\n");
 	printf("  Examples:\n");
 	printf("    Run SmartVIO sequence:\n");
 	printf("      %s -r /dev/i2c-1\n", progname);
 	printf("    Dump DNA from the MCU on Port 1:\n");
 	printf("      %s -d dna_file.bin -p 1 /dev/i2c-1\n", progname);
+	printf("    Provision the peripherals listed in station.manifest:\n");
+	printf("      %s -m station.manifest /dev/i2c-1\n", progname);
+	printf("    Check for peripheral changes:\n");
+	printf("      %s -c /var/run/smartvio.state /dev/i2c-1\n", progname);
 	printf("    Set VIO1 to 3.3V:\n");
 	printf("      %s -s -1 330 /dev/i2c-1\n", progname);
 }
@@ -538,21 +1100,35 @@ int main (int argc, char *argv[])
 	int hflag = 0;
 	int wflag = 0;
 	int dflag = 0;
+	int cflag = 0;
+	int nflag = 0;
+	int mflag = 0;
+	int solver = svio_solvers[0].method;
 	uint32_t svio1 = 0;
 	uint32_t svio2 = 0;
 	char i2c_filename[200];
 	char dna_filename[200];
-	uint8_t dna_buf[1320];
-	int i2c_file;
+	char state_filename[200];
+	char manifest_filename[200];
+	std::vector<manifestAdapter> manifest;
+	dnaState dna_state[szgCarrier::num_ports];
+	int dna_known[szgCarrier::num_ports];
+	int dna_changed[szgCarrier::num_ports];
+	dnaWriteReport write_report;
+	int i;
+	uint8_t dna_buf[SZG_DNA_MAX_LENGTH];
+	szgDNA dna;
+	szgDNACache cache;
+	szgSmartVIOContext ctx;
+	szgBus bus;
 	int dna_file;
 	int dna_length = 0;
 	int periph_num = 0;
 	int curr_opt;
 	json json_handler;
-	uint16_t peripheral_address[] = {0x30, 0x31, 0x32, 0x33};
 
 	// Parse args
-	while ((curr_opt = getopt(argc, argv, "rsj1:2:w:d:p:h")) != -1) {
+	while ((curr_opt = getopt(argc, argv, "rsj1:2:w:d:c:m:p:S:nh")) != -1) {
 		switch(curr_opt)
 		{
 			case 'r':
@@ -598,14 +1174,52 @@ int main (int argc, char *argv[])
 					exit(EXIT_FAILURE);
 				}
 				break;
+			case 'c':
+				cflag = 1;
+				if (optarg){ 
+					strcpy(state_filename, optarg);
+				} else {
+					printf("No argument specified for -c\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'm':
+				mflag = 1;
+				if (optarg){ 
+					strcpy(manifest_filename, optarg);
+				} else {
+					printf("No argument specified for -m\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'p':
 				if (optarg){ 
 					periph_num = strtol(optarg, NULL, 0) - 1;
+					if ((periph_num < 0)
+					    || (periph_num >= szgCarrierPeripherals<szgCarrier>())) {
+						printf("Invalid peripheral number %s for -p\n", optarg);
+						exit(EXIT_FAILURE);
+					}
 				} else {
 					printf("No argument specified for -p\n");
 					exit(EXIT_FAILURE);
 				}
 				break;
+			case 'n':
+				nflag = 1;
+				break;
+			case 'S':
+				for (i = 0; i < (int)(sizeof(svio_solvers) / sizeof(svio_solvers[0])); i++) {
+					if (strcmp(optarg, svio_solvers[i].name) == 0) {
+						solver = svio_solvers[i].method;
+						break;
+					}
+				}
+				if (i == (int)(sizeof(svio_solvers) / sizeof(svio_solvers[0]))) {
+					printf("Unknown solver %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'h':
 				hflag = 1;
 				break;
@@ -632,21 +1246,20 @@ int main (int argc, char *argv[])
 	}
 
 	// Open I2C file
-	i2c_file = open(i2c_filename, O_RDWR);
-	if (i2c_file < 0) {
+	if (bus.open(i2c_filename) != 0) {
 		printf("Error opening i2c device\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if ((rflag + sflag + jflag + hflag + wflag + dflag) > 1) {
+	if ((rflag + sflag + jflag + hflag + wflag + dflag + cflag + mflag) > 1) {
 		printf("Invalid set of options specified.\n");
 		printHelp(argv[0]);
 		return 0;
 	}
 
 	if ((wflag == 1) || (dflag == 1)) {
-		if (i2cDetect(i2c_file, peripheral_address[periph_num]) != 0) {
-			printf("Peripheral at %X not found\n", peripheral_address[periph_num]);
+		if (bus.i2cDetect(peripheralAddress(periph_num)) != 0) {
+			printf("Peripheral at %X not found\n", peripheralAddress(periph_num));
 			exit(EXIT_FAILURE);
 		}
 
@@ -657,31 +1270,38 @@ int main (int argc, char *argv[])
 		}
 	}
 
+	if (((rflag == 1) || (jflag == 1)) && (nflag == 0)
+	    && (SZG_BUS_DEFAULT_DNA_CACHE || (getenv("SZG_DNA_CACHE_DIR") != NULL))) {
+		// Runs without the cache when it is unavailable
+		cache.open(NULL, i2c_filename);
+	}
+
 	if (rflag == 1) { // Run the main SmartVIO procedure
-		if (readDNA(i2c_file, &svio1, &svio2) != 0) {
+		if (readDNA(bus, ctx, cache, solver, &svio1, &svio2) != 0) {
 			printf("Error obtaining a SmartVIO solution\n");
 			exit(EXIT_FAILURE);
 		}
 
-		if (applyVIO(i2c_file, svio1, svio2) != 0) {
+		if (applyVIO(bus, svio1, svio2) != 0) {
 			printf("Error applying SmartVIO settings to power supplies\n");
 			exit(EXIT_FAILURE);
 		}
 
-		if (printVIOStrings(json_handler, i2c_file) != 0) {
+		if (printVIOStrings(ctx, json_handler) != 0) {
 			printf("Error retrieving DNA strings\n");
 			exit(EXIT_FAILURE);
 		}
 	} else if (sflag == 1) { // Apply a user specified VIO
-		if (applyVIO(i2c_file, svio1, svio2) != 0) {
+		if (applyVIO(bus, svio1, svio2) != 0) {
 			printf("Error applying SmartVIO settings to power supplies\n");
 			exit(EXIT_FAILURE);
 		}
 	} else if (jflag == 1) {
-		readDNA(i2c_file, &svio1, &svio2);
+		readDNA(bus, ctx, cache, solver, &svio1, &svio2);
 
 		// Bounds check on the svio ranges
-		if ((svio1 < 120) || (svio1 > 330) || (svio2 < 120) || (svio2 > 330)) {
+		if ((svio1 < 120) || (svio1 > 330)
+		    || ((szgCarrier::num_groups > 1) && ((svio2 < 120) || (svio2 > 330)))) {
 			json_handler["vio"][0] = 0;
 			json_handler["vio"][1] = 0;
 		} else {
@@ -689,7 +1309,7 @@ int main (int argc, char *argv[])
 			json_handler["vio"][1] = svio2;
 		}
 
-		printVIOStrings(json_handler, i2c_file);
+		printVIOStrings(ctx, json_handler);
 
 		printf(json_handler.dump().c_str());
 		printf("\n");
@@ -699,7 +1319,7 @@ int main (int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 
-		if (dna_length > 1318) {
+		if (dna_length > SZG_DNA_MAX_LENGTH) {
 			printf("Invalid DNA Length\n");
 			exit(EXIT_FAILURE);
 		}
@@ -710,28 +1330,81 @@ int main (int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 
-		if (writeMCU(i2c_file, peripheral_address[periph_num], 0x8000,
-		             dna_buf, dna_length) != 0) {
+		if (writeDNA(bus, peripheralAddress(periph_num), dna_buf, dna_length,
+		             &write_report) != 0) {
 			printf("Error writing to the MCU\n");
 			exit(EXIT_FAILURE);
 		}
+
+		printf("Wrote %d of %d pages to 0x%X, planned %.1f ms, took %.1f ms\n",
+		       write_report.pages, write_report.total_pages,
+		       peripheralAddress(periph_num), write_report.planned_us / 1e3,
+		       write_report.actual_us / 1e3);
+		if (write_report.measured_us > 0) {
+			printf("Measured write cycle %.2f ms, planned %.2f ms\n",
+			       write_report.measured_us / 1e3, write_report.cycle_us / 1e3);
+		}
+		printf("Verified by %s\n", write_report.full_readback
+		                             ? "full readback" : "readback of the pages written");
 	} else if (dflag == 1) { // Dump DNA from a peripheral to a file
-		dna_length = dumpDNA(i2c_file, peripheral_address[periph_num], dna_buf);
+		dna_length = dumpDNA(bus, peripheralAddress(periph_num), dna);
 
 		if (dna_length < 0) {
 			printf("Error reading DNA from device\n");
 			exit(EXIT_FAILURE);
 		}
 		
-		if (write(dna_file, dna_buf, dna_length) != dna_length) {
+		if (write(dna_file, dna.data(), dna_length) != dna_length) {
 			printf("Error writing to DNA file\n");
 			exit(EXIT_FAILURE);
 		}
+	} else if (mflag == 1) { // Provision the ports listed in a manifest
+		if (loadManifest(manifest_filename, i2c_filename, manifest) != 0) {
+			exit(EXIT_FAILURE);
+		}
+
+#if defined(SZG_BUS_RECORD)
+		// Every recording bus writes to the one $SZG_TRACE_FILE
+		if (manifest.size() > 1) {
+			printf("Recording builds provision a single adapter per run\n");
+			exit(EXIT_FAILURE);
+		}
+#endif
+
+		i = provisionAdapters(bus, i2c_filename, manifest, json_handler);
+
+		printf("%s\n", json_handler.dump().c_str());
+		bus.close();
+
+		return (i == 0) ? 0 : EXIT_FAILURE;
+	} else if (cflag == 1) { // Check for peripheral changes
+		loadDNAState(state_filename, dna_state, dna_known);
+
+		if (checkDNA(bus, dna_state, dna_known, dna_changed) < 0) {
+			printf("Error checking peripherals\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < szgCarrier::num_ports; i++) {
+			if (szgCarrier::port(i).i2c_addr == 0x00) {
+				continue;
+			}
+
+			printf("Port 0x%X %s\n", szgCarrier::port(i).i2c_addr,
+			       dna_changed[i] ? "changed" : "unchanged");
+		}
+
+		if (saveDNAState(state_filename, dna_state) != 0) {
+			printf("Error writing state file\n");
+			exit(EXIT_FAILURE);
+		}
 	} else {
 		printHelp(argv[0]);
 		return 0;
 	}
 
+	bus.close();
+
 	return 0;
 }
 
@@ -26,10 +26,51 @@
 //------------------------------------------------------------------------
 
 
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "syzygy.h"
+#include "szg_crc_table.h"
+
+
+/// Advances a CRC-16/CCITT computation over another block of data, so that a
+/// CRC can be built up as the data arrives. Start from SZG_CRC_INIT; feeding
+/// a buffer in any number of pieces gives the same result as szgComputeCRC
+/// over the whole buffer.
+///
+/// Eight bytes are folded into the CRC per step using the slice-by-8 tables
+/// in szg_crc_table.h, the tail is handled a byte at a time.
+///
+/// \returns Updated 16-bit CRC.
+unsigned short
+szgCRCUpdate(unsigned short crc, const unsigned char *data, unsigned int length)
+{
+	while (length >= 8) {
+		crc = szgCRCTable[7][(crc >> 8) ^ data[0]]
+		    ^ szgCRCTable[6][(crc & 0xff) ^ data[1]]
+		    ^ szgCRCTable[5][data[2]]
+		    ^ szgCRCTable[4][data[3]]
+		    ^ szgCRCTable[3][data[4]]
+		    ^ szgCRCTable[2][data[5]]
+		    ^ szgCRCTable[1][data[6]]
+		    ^ szgCRCTable[0][data[7]];
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc = (crc << 8) ^ szgCRCTable[0][(crc >> 8) ^ *data++];
+	}
+	return(crc);
+}
 
 
-/// Computes the CRC-16/CCITT checksum using parallel computation without tables.
+/// Computes the CRC-16/CCITT checksum of a buffer.
 /// https://en.wikipedia.org/wiki/Computation_of_cyclic_redundancy_checks
 ///
 /// Polynomial: 0x1021 (x^16 + x^12 + x^5 + x^0)
@@ -40,15 +81,142 @@
 unsigned short
 szgComputeCRC(const unsigned char *data, unsigned int length)
 {
-	unsigned short x, crc = 0xffff;
+	return(szgCRCUpdate(SZG_CRC_INIT, data, length));
+}
 
-	while (length--){
-		x = (crc >> 8) ^ *data++;
-		x ^= x>>4;
-		crc = (crc<<8) ^ (x<<12) ^ (x<<5) ^ (x);
-		crc &= 0xffff;
+
+/// Computes the CRC-16/CCITT checksum of each of 'count' buffers, storing
+/// the result for data[i] in crcs[i].
+void
+szgComputeCRCs(const unsigned char *const *data, const unsigned int *lengths,
+               unsigned short *crcs, unsigned int count)
+{
+	unsigned int i;
+
+	for (i=0; i<count; i++) {
+		crcs[i] = szgComputeCRC(data[i], lengths[i]);
 	}
-	return(crc);
+}
+
+
+/// Validates the CRC of 'count' DNA headers laid out 'stride' bytes apart,
+/// as in an array of DNA dumps. valid[i] is set to 1 if header i checks out,
+/// 0 otherwise.
+///
+/// Headers are processed four at a time with their byte loops interleaved,
+/// the four CRC chains being independent of one another.
+///
+/// \returns Number of valid headers.
+unsigned int
+szgCheckDNAHeaders(const unsigned char *dna, unsigned int count,
+                   unsigned int stride, unsigned char *valid)
+{
+	unsigned short c0, c1, c2, c3;
+	const unsigned char *d0, *d1, *d2, *d3;
+	unsigned int i, j;
+	unsigned int n = 0;
+
+
+	for (i=0; i+4<=count; i+=4) {
+		d0 = dna + (i + 0) * stride;
+		d1 = dna + (i + 1) * stride;
+		d2 = dna + (i + 2) * stride;
+		d3 = dna + (i + 3) * stride;
+		c0 = c1 = c2 = c3 = SZG_CRC_INIT;
+
+		for (j=0; j<SZG_DNA_HEADER_LENGTH_V1; j++) {
+			c0 = (c0 << 8) ^ szgCRCTable[0][(c0 >> 8) ^ d0[j]];
+			c1 = (c1 << 8) ^ szgCRCTable[0][(c1 >> 8) ^ d1[j]];
+			c2 = (c2 << 8) ^ szgCRCTable[0][(c2 >> 8) ^ d2[j]];
+			c3 = (c3 << 8) ^ szgCRCTable[0][(c3 >> 8) ^ d3[j]];
+		}
+
+		valid[i + 0] = (c0 == 0);
+		valid[i + 1] = (c1 == 0);
+		valid[i + 2] = (c2 == 0);
+		valid[i + 3] = (c3 == 0);
+		n += valid[i] + valid[i + 1] + valid[i + 2] + valid[i + 3];
+	}
+
+	for (; i<count; i++) {
+		valid[i] = (szgComputeCRC(dna + i * stride, SZG_DNA_HEADER_LENGTH_V1) == 0);
+		n += valid[i];
+	}
+	return(n);
+}
+
+
+
+/// Firmware characteristics by DNA version: the longest I2C read served, and
+/// the write page size and nominal write cycle of the DNA storage. DNA
+/// versions not listed here get the SZG_MAX_DNA_I2C_READ_LENGTH,
+/// SZG_DNA_PAGE_SIZE and SZG_DNA_WRITE_CYCLE_US defaults.
+static const struct {
+	unsigned char  major;
+	unsigned char  minor;
+	int            max_read_length;
+	int            page_size;
+	int            write_cycle_us;
+} szgDNAFirmware[] = {
+	{ 1, 0, SZG_MAX_DNA_I2C_READ_LENGTH, SZG_DNA_PAGE_SIZE, SZG_DNA_WRITE_CYCLE_US },
+	{ 1, 1, SZG_MAX_DNA_I2C_READ_LENGTH, SZG_DNA_PAGE_SIZE, SZG_DNA_WRITE_CYCLE_US },
+};
+
+
+/// Looks up the firmware table entry for the DNA version in a header.
+///
+/// \returns Index of the entry, -1 if the version is not listed.
+static int
+szgDNAFirmwareIndex(const unsigned char *dnaBuf)
+{
+	unsigned int i;
+
+	for (i=0; i<sizeof(szgDNAFirmware)/sizeof(szgDNAFirmware[0]); i++) {
+		if ((szgDNAFirmware[i].major == dnaBuf[SZG_DNA_PTR_DNA_MAJOR])
+		    && (szgDNAFirmware[i].minor == dnaBuf[SZG_DNA_PTR_DNA_MINOR])) {
+			return(i);
+		}
+	}
+	return(-1);
+}
+
+
+/// Determines the longest I2C read supported by a peripheral's firmware from
+/// the DNA version fields in its header.
+///
+/// \returns Maximum read length in bytes.
+int
+szgDNAMaxReadLength(const unsigned char *dnaBuf)
+{
+	int i = szgDNAFirmwareIndex(dnaBuf);
+
+	return((i < 0) ? SZG_MAX_DNA_I2C_READ_LENGTH : szgDNAFirmware[i].max_read_length);
+}
+
+
+/// Determines the write page size of a peripheral's DNA storage from the DNA
+/// version fields in its header.
+///
+/// \returns Page size in bytes.
+int
+szgDNAPageSize(const unsigned char *dnaBuf)
+{
+	int i = szgDNAFirmwareIndex(dnaBuf);
+
+	return((i < 0) ? SZG_DNA_PAGE_SIZE : szgDNAFirmware[i].page_size);
+}
+
+
+/// Determines the nominal time a peripheral takes to commit one page of DNA
+/// from the DNA version fields in its header.
+///
+/// \returns Write cycle in microseconds.
+int
+szgDNAWriteCycleUs(const unsigned char *dnaBuf)
+{
+	int i = szgDNAFirmwareIndex(dnaBuf);
+
+	return((i < 0) ? SZG_DNA_WRITE_CYCLE_US : szgDNAFirmware[i].write_cycle_us);
 }
 
 
@@ -58,7 +226,7 @@ szgComputeCRC(const unsigned char *data, unsigned int length)
 ///
 /// \returns -1 if the call failed. 0 on success.
 int
-szgParsePortDNA(int n, szgSmartVIOConfig *svio, unsigned char *dnaBuf, int length)
+szgParsePortDNA(int n, szgSmartVIOConfig *svio, const unsigned char *dnaBuf, int length)
 {
 	int i;
 	int vmin, vmax;
@@ -143,7 +311,7 @@ szgSolveSmartVIOGroup(szgSmartVIOPort *ports, int group_mask)
 		// Prior to each intervals test, start with the least restrictive interval.
 		// As we inspect the port settings, this interval will shrink.
 		fmin = 0;
-		fmax = 500;
+		fmax = SZG_SVIO_MAX_VOLTAGE;
 
 		for (i=0; i<SVIO_NUM_PORTS; i++) {
 			if (0 == ports[i].present) {
@@ -208,3 +376,390 @@ szgSolveSmartVIOGroup(szgSmartVIOPort *ports, int group_mask)
 	}
 	return(-1);
 }
+
+
+
+/// Checks that a peripheral can be driven by this library from the
+/// required DNA version in its header, and that a TXR2 or TXR4 peripheral
+/// sits in a matching port.
+///
+/// \returns 1 if the port is usable, 0 otherwise.
+static int
+szgPortSupported(const szgSmartVIOPort *port)
+{
+	if (port->req_ver_major > SVIO_IMPL_VER_MAJOR) {
+		return(0);
+	} else if ((port->req_ver_major == SVIO_IMPL_VER_MAJOR)
+	        && (port->req_ver_minor > SVIO_IMPL_VER_MINOR)) {
+		return(0);
+	}
+
+	if ((port->port_attr ^ port->attr) & SZG_ATTR_TXR4) {
+		return(0);
+	}
+	return(1);
+}
+
+
+/// Orders sweep events by position. See szgSolveSmartVIOSweep.
+static int
+szgCompareEvents(const void *a, const void *b)
+{
+	return(*(const int *)a - *(const int *)b);
+}
+
+
+/// Finds the lowest voltage in [1, SZG_SVIO_MAX_VOLTAGE] supported by every
+/// present port of a group that declares ranges. Each port's ranges are
+/// turned into +1 and -1 events at the start and just past the end of the
+/// range, the events are sorted once and swept in order while counting the
+/// ports covering the current voltage. Ranges of one port that overlap are
+/// merged first, so that a voltage only counts once per port. The cost is
+/// O(n log n) in the total number of ranges.
+///
+/// \returns -1 if a solution was not found. The voltage otherwise.
+static int
+szgSolveSmartVIOSweep(const szgSmartVIOPort *ports, int group_mask)
+{
+	// Events encode (position << 1) | is_start, so that sorting orders them
+	// by position. Only positions matter as all events at one position are
+	// applied before the count is examined.
+	int events[2 * SVIO_NUM_PORTS * SZG_MAX_DNA_RANGES];
+	int ranges[SZG_MAX_DNA_RANGES][2];
+	int num_events = 0;
+	int num_ports = 0;
+	int count = 0;
+	int i, j, k, n;
+	int vmin, vmax, pos;
+
+
+	for (i=0; i<SVIO_NUM_PORTS; i++) {
+		if ((0 == ports[i].present) || (0 == (group_mask & (1 << ports[i].group)))) {
+			continue;
+		}
+
+		if (!szgPortSupported(&ports[i])) {
+			return(-1);
+		}
+
+		// Clip the port's ranges to the solution domain, then sort them by
+		// their minimum for merging. There are at most SZG_MAX_DNA_RANGES.
+		n = 0;
+		for (j=0; j<ports[i].range_count; j++) {
+			vmin = szgMAX(ports[i].ranges[j].min, 1);
+			vmax = szgMIN(ports[i].ranges[j].max, SZG_SVIO_MAX_VOLTAGE);
+			if (vmin > vmax) {
+				continue;
+			}
+			for (k=n; (k > 0) && (ranges[k-1][0] > vmin); k--) {
+				ranges[k][0] = ranges[k-1][0];
+				ranges[k][1] = ranges[k-1][1];
+			}
+			ranges[k][0] = vmin;
+			ranges[k][1] = vmax;
+			n++;
+		}
+
+		// Ports without usable ranges don't constrain the solution, unless
+		// they declared ranges that all fall outside the domain.
+		if (n == 0) {
+			if (ports[i].range_count > 0) {
+				return(-1);
+			}
+			continue;
+		}
+
+		num_ports++;
+		for (j=0; j<n; j++) {
+			vmin = ranges[j][0];
+			vmax = ranges[j][1];
+			while ((j+1 < n) && (ranges[j+1][0] <= vmax + 1)) {
+				j++;
+				vmax = szgMAX(vmax, ranges[j][1]);
+			}
+			events[num_events++] = (vmin << 1) | 1;
+			events[num_events++] = ((vmax + 1) << 1);
+		}
+	}
+
+	if (num_ports == 0) {
+		return(-1);
+	}
+
+	qsort(events, num_events, sizeof(events[0]), szgCompareEvents);
+
+	for (i=0; i<num_events; ) {
+		pos = events[i] >> 1;
+		for (; (i < num_events) && ((events[i] >> 1) == pos); i++) {
+			count += (events[i] & 1) ? 1 : -1;
+		}
+		if (count == num_ports) {
+			return(pos);
+		}
+	}
+	return(-1);
+}
+
+
+/// Sets the bits of a voltage map for every voltage in [1,
+/// SZG_SVIO_MAX_VOLTAGE] that falls in one of a port's ranges. Each range is
+/// applied a word at a time.
+void
+szgPortVoltageMap(const szgSmartVIOPort *port, uint64_t *map)
+{
+	int i, w;
+	int vmin, vmax;
+	int lo, hi;
+
+
+	for (w=0; w<SZG_SVIO_MAP_WORDS; w++) {
+		map[w] = 0;
+	}
+
+	for (i=0; i<port->range_count; i++) {
+		vmin = szgMAX(port->ranges[i].min, 1);
+		vmax = szgMIN(port->ranges[i].max, SZG_SVIO_MAX_VOLTAGE);
+
+		for (w=vmin/64; (vmin <= vmax) && (w <= vmax/64); w++) {
+			lo = (w == vmin/64) ? vmin % 64 : 0;
+			hi = (w == vmax/64) ? vmax % 64 : 63;
+			map[w] |= (~0ULL >> (63 - hi)) & (~0ULL << lo);
+		}
+	}
+}
+
+
+/// Intersects voltage map 'src' into 'dst', using 128-bit vector ANDs on
+/// targets with SSE2 or NEON and 64-bit words elsewhere.
+void
+szgVoltageMapAnd(uint64_t *dst, const uint64_t *src)
+{
+	int w;
+
+#if defined(__SSE2__)
+	for (w=0; w+2<=SZG_SVIO_MAP_WORDS; w+=2) {
+		_mm_storeu_si128((__m128i *)&dst[w],
+		                 _mm_and_si128(_mm_loadu_si128((const __m128i *)&dst[w]),
+		                               _mm_loadu_si128((const __m128i *)&src[w])));
+	}
+#elif defined(__ARM_NEON)
+	for (w=0; w+2<=SZG_SVIO_MAP_WORDS; w+=2) {
+		vst1q_u64(&dst[w], vandq_u64(vld1q_u64(&dst[w]), vld1q_u64(&src[w])));
+	}
+#else
+	w = 0;
+#endif
+
+	for (; w<SZG_SVIO_MAP_WORDS; w++) {
+		dst[w] &= src[w];
+	}
+}
+
+
+/// Picks a voltage from a voltage map:
+///
+/// SZG_SOLVE_BITSET_LOW    - the lowest voltage set
+/// SZG_SOLVE_BITSET_HIGH   - the highest voltage set
+/// SZG_SOLVE_BITSET_CENTER - the middle of the widest run of voltages set,
+///                           the lower middle and the lowest run on ties
+///
+/// \returns -1 if no voltage is set. The voltage otherwise.
+int
+szgVoltageMapPick(const uint64_t *map, int pick)
+{
+	int w, v;
+	int run_start = -1;
+	int best_start = -1;
+	int best_length = 0;
+
+
+	if (pick == SZG_SOLVE_BITSET_LOW) {
+		for (w=0; w<SZG_SVIO_MAP_WORDS; w++) {
+			if (map[w] != 0) {
+				return(w * 64 + __builtin_ctzll(map[w]));
+			}
+		}
+		return(-1);
+	}
+
+	if (pick == SZG_SOLVE_BITSET_HIGH) {
+		for (w=SZG_SVIO_MAP_WORDS-1; w>=0; w--) {
+			if (map[w] != 0) {
+				return(w * 64 + 63 - __builtin_clzll(map[w]));
+			}
+		}
+		return(-1);
+	}
+
+	for (v=0; v<=SZG_SVIO_MAP_WORDS * 64; v++) {
+		if ((v < SZG_SVIO_MAP_WORDS * 64) && ((map[v / 64] >> (v % 64)) & 1)) {
+			if (run_start < 0) {
+				run_start = v;
+			}
+		} else if (run_start >= 0) {
+			if (v - run_start > best_length) {
+				best_start = run_start;
+				best_length = v - run_start;
+			}
+			run_start = -1;
+		}
+	}
+
+	return((best_start < 0) ? -1 : best_start + (best_length - 1) / 2);
+}
+
+
+/// Solves a group by intersecting the voltage maps of its present ports,
+/// then picking a voltage from what survives. The cost does not depend on
+/// the number of ranges beyond building each port's map.
+///
+/// \returns -1 if a solution was not found. The voltage otherwise.
+static int
+szgSolveSmartVIOBitset(const szgSmartVIOPort *ports, int group_mask, int pick)
+{
+	uint64_t acc[SZG_SVIO_MAP_WORDS];
+	uint64_t map[SZG_SVIO_MAP_WORDS];
+	int constrained = 0;
+	int i;
+
+
+	for (i=0; i<SVIO_NUM_PORTS; i++) {
+		if ((0 == ports[i].present) || (0 == (group_mask & (1 << ports[i].group)))) {
+			continue;
+		}
+
+		if (!szgPortSupported(&ports[i])) {
+			return(-1);
+		}
+
+		// Ports without ranges don't constrain the solution
+		if (ports[i].range_count == 0) {
+			continue;
+		}
+
+		if (constrained) {
+			szgPortVoltageMap(&ports[i], map);
+			szgVoltageMapAnd(acc, map);
+		} else {
+			szgPortVoltageMap(&ports[i], acc);
+			constrained = 1;
+		}
+	}
+
+	if (!constrained) {
+		return(-1);
+	}
+	return(szgVoltageMapPick(acc, pick));
+}
+
+
+/// Searches for a VIO solution that satisfies all present ports of a group
+/// using the given method:
+///
+/// SZG_SOLVE_FIRST_FOUND - the combination search of szgSolveSmartVIOGroup,
+///                         returning the first solution it comes across
+/// SZG_SOLVE_SWEEP       - a sweep over the sorted range endpoints,
+///                         returning the lowest voltage every port supports
+/// SZG_SOLVE_BITSET_LOW, SZG_SOLVE_BITSET_HIGH, SZG_SOLVE_BITSET_CENTER
+///                       - an intersection of the ports' voltage maps,
+///                         returning the voltage picked by szgVoltageMapPick
+///
+/// \returns -1 if a solution was not found. The voltage otherwise.
+int
+szgSolveSmartVIO(szgSmartVIOPort *ports, int group_mask, int method)
+{
+	switch (method) {
+		case SZG_SOLVE_FIRST_FOUND:
+			return(szgSolveSmartVIOGroup(ports, group_mask));
+		case SZG_SOLVE_SWEEP:
+			return(szgSolveSmartVIOSweep(ports, group_mask));
+		case SZG_SOLVE_BITSET_LOW:
+		case SZG_SOLVE_BITSET_HIGH:
+		case SZG_SOLVE_BITSET_CENTER:
+			return(szgSolveSmartVIOBitset(ports, group_mask, method));
+	}
+	return(-1);
+}
+
+
+/// Finds the representative of a group in a union-find forest, halving the
+/// path on the way up.
+///
+/// \returns the representative group.
+static int
+szgGroupFind(int *parent, int group)
+{
+	while (parent[group] != group) {
+		parent[group] = parent[parent[group]];
+		group = parent[group];
+	}
+
+	return(group);
+}
+
+
+/// Solves every SmartVIO group of a carrier, treating groups joined by a
+/// doublewide peripheral as one. The group masks, as filled in by
+/// szgParsePortDNA, are merged into connected components with union-find,
+/// so that groups joined through a chain of doublewide peripherals end up
+/// together. Each component is solved once with the given method and its
+/// voltage is stored in 'results' for every group in it, 0 if it has no
+/// solution.
+///
+/// \returns the number of groups without a solution.
+int
+szgSolveSmartVIOComponents(szgSmartVIOPort *ports, const int *group_masks,
+                           int num_groups, int *results, int method)
+{
+	int parent[SVIO_NUM_GROUPS];
+	int component_mask[SVIO_NUM_GROUPS];
+	int failed = 0;
+	int i, j;
+	int a, b;
+	int vmin;
+
+
+	for (i=0; i<num_groups; i++) {
+		parent[i] = i;
+		component_mask[i] = 0;
+	}
+
+	// The lower group becomes the representative, keeping the components
+	// independent of the order the masks are visited in
+	for (i=0; i<num_groups; i++) {
+		for (j=0; j<num_groups; j++) {
+			if ((i == j) || (0 == (group_masks[i] & (1 << j)))) {
+				continue;
+			}
+
+			a = szgGroupFind(parent, i);
+			b = szgGroupFind(parent, j);
+			if (a < b) {
+				parent[b] = a;
+			} else if (b < a) {
+				parent[a] = b;
+			}
+		}
+	}
+
+	for (i=0; i<num_groups; i++) {
+		component_mask[szgGroupFind(parent, i)] |= (1 << i);
+	}
+
+	for (i=0; i<num_groups; i++) {
+		if (0 == component_mask[i]) {
+			continue;
+		}
+
+		vmin = szgSolveSmartVIO(ports, component_mask[i], method);
+
+		for (j=0; j<num_groups; j++) {
+			if (component_mask[i] & (1 << j)) {
+				results[j] = (vmin > 0) ? vmin : 0;
+				failed += (vmin > 0) ? 0 : 1;
+			}
+		}
+	}
+
+	return(failed);
+}
@@ -0,0 +1,175 @@
+// SYZYGY DNA
+//
+// On-disk cache of peripheral DNAs.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "szg_dna.hpp"
+
+
+int szgDNACache::open (const char *path, const char *adapter_path)
+{
+	struct stat st;
+	int i;
+
+	dir[0] = '\0';
+	adapter[0] = '\0';
+
+	if (path == NULL) {
+		path = getenv("SZG_DNA_CACHE_DIR");
+	}
+	if (path == NULL) {
+		path = SZG_DNA_CACHE_DEFAULT_DIR;
+	}
+
+	if ((path[0] == '\0')
+	    || (strlen(path) + strlen(adapter_path) >= sizeof(dir) - 16)) {
+		return -1;
+	}
+
+	if ((mkdir(path, 0755) != 0) && (errno != EEXIST)) {
+		return -1;
+	}
+	if ((stat(path, &st) != 0) || !S_ISDIR(st.st_mode)
+	    || (access(path, R_OK | W_OK | X_OK) != 0)) {
+		return -1;
+	}
+
+	// Entries of each i2c device are kept apart, /dev/i2c-1 becoming
+	// dev_i2c-1-port-30.dna and so on
+	while (*adapter_path == '/') {
+		adapter_path++;
+	}
+	for (i = 0; adapter_path[i] != '\0'; i++) {
+		adapter[i] = (adapter_path[i] == '/') ? '_' : adapter_path[i];
+	}
+	adapter[i] = '\0';
+
+	strcpy(dir, path);
+
+	return 0;
+}
+
+
+int szgDNACache::load (int i2c_addr, szgDNA &dna) const
+{
+	char path[SZG_DNA_CACHE_PATH_LENGTH];
+	int fd;
+	int length;
+
+	if (!enabled()) {
+		return -1;
+	}
+
+	entryPath(i2c_addr, path, sizeof(path));
+
+	fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+
+	length = read(fd, dna.data(), SZG_DNA_MAX_LENGTH);
+	close(fd);
+
+	dna.setLength(length);
+
+	// Only accept entries that are internally consistent
+	if (!dna.headerValid() || (dna.size() < dna.stringsEnd())) {
+		dna.setLength(0);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int szgDNACache::store (int i2c_addr, const szgDNA &dna) const
+{
+	char path[SZG_DNA_CACHE_PATH_LENGTH];
+	char tmp_path[SZG_DNA_CACHE_PATH_LENGTH + 8];
+	int fd;
+
+	if (!enabled()) {
+		return -1;
+	}
+
+	entryPath(i2c_addr, path, sizeof(path));
+
+	// A unique temporary file lets several readers store the same entry
+	// at once, the last rename wins
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+	fd = mkstemp(tmp_path);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (fchmod(fd, 0644) != 0) {
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	if ((write(fd, dna.data(), dna.size()) != dna.size()) || (fsync(fd) != 0)) {
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+	close(fd);
+
+	if (rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void szgDNACache::invalidate (int i2c_addr) const
+{
+	char path[SZG_DNA_CACHE_PATH_LENGTH];
+
+	if (!enabled()) {
+		return;
+	}
+
+	entryPath(i2c_addr, path, sizeof(path));
+	unlink(path);
+}
+
+
+void szgDNACache::entryPath (int i2c_addr, char *path, int length) const
+{
+	snprintf(path, length, "%s/%s-port-%02x.dna", dir, adapter, i2c_addr);
+}
@@ -0,0 +1,718 @@
+// SYZYGY I2C Transport Library
+//
+// Shared Linux i2c-dev transport used by the SYZYGY Brain tools.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "szg_i2c.h"
+
+
+/// \returns The value of the monotonic clock in microseconds.
+uint64_t
+szgI2CTimeUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+
+/// Sleeps for the given number of microseconds.
+static void
+szgI2CSleepUs(unsigned int us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+
+/// \returns The time on the clock of a bus handle's adapter in microseconds.
+uint64_t
+szgI2CBusTimeUs(szgI2CBus *bus)
+{
+	if (bus->adapter != NULL) {
+		return(bus->adapter->time_us(bus->adapter->ctx));
+	}
+	return(szgI2CTimeUs());
+}
+
+
+/// Sleeps for the given number of microseconds on the clock of a bus
+/// handle's adapter.
+static void
+szgI2CBusSleepUs(szgI2CBus *bus, unsigned int us)
+{
+	if (bus->adapter != NULL) {
+		bus->adapter->sleep_us(bus->adapter->ctx, us);
+		return;
+	}
+	szgI2CSleepUs(us);
+}
+
+
+/// Opens a file on the adapter of a bus handle and stores it in bus->file.
+///
+/// \returns -1 if the file could not be opened. 0 on success.
+static int
+szgI2CFileOpen(szgI2CBus *bus, const char *filename)
+{
+	if (bus->adapter != NULL) {
+		bus->file = bus->adapter->open(bus->adapter->ctx, filename);
+	} else {
+		bus->file = open(filename, O_RDWR);
+	}
+
+	return((bus->file < 0) ? -1 : 0);
+}
+
+
+/// Closes the file of a bus handle on its adapter.
+static void
+szgI2CFileClose(szgI2CBus *bus)
+{
+	if (bus->adapter != NULL) {
+		bus->adapter->close(bus->adapter->ctx, bus->file);
+	} else {
+		close(bus->file);
+	}
+}
+
+
+/// Issues an ioctl on the file of a bus handle.
+///
+/// \returns The result of the ioctl, -1 with errno set on failure.
+static int
+szgI2CIoctl(szgI2CBus *bus, unsigned long request, unsigned long arg)
+{
+	if (bus->adapter != NULL) {
+		return(bus->adapter->ioctl(bus->adapter->ctx, bus->file, request, arg));
+	}
+	return(ioctl(bus->file, request, arg));
+}
+
+
+/// Reads from the device selected on the file of a bus handle.
+///
+/// \returns The number of bytes read, -1 with errno set on failure.
+static int
+szgI2CFileRead(szgI2CBus *bus, uint8_t *data, int length)
+{
+	if (bus->adapter != NULL) {
+		return(bus->adapter->read(bus->adapter->ctx, bus->file, data, length));
+	}
+	return(read(bus->file, data, length));
+}
+
+
+/// Writes to the device selected on the file of a bus handle.
+///
+/// \returns The number of bytes written, -1 with errno set on failure.
+static int
+szgI2CFileWrite(szgI2CBus *bus, const uint8_t *data, int length)
+{
+	if (bus->adapter != NULL) {
+		return(bus->adapter->write(bus->adapter->ctx, bus->file, data, length));
+	}
+	return(write(bus->file, data, length));
+}
+
+
+/// Opens a Linux i2c device and initializes the bus handle.
+///
+/// \returns -1 if the device could not be opened. 0 on success.
+int
+szgI2COpen(szgI2CBus *bus, const char *filename)
+{
+	return(szgI2COpenAdapter(bus, filename, NULL));
+}
+
+
+/// Opens a device on the given adapter, the Linux i2c-dev driver if it is
+/// NULL, and initializes the bus handle.
+///
+/// \returns -1 if the device could not be opened. 0 on success.
+int
+szgI2COpenAdapter(szgI2CBus *bus, const char *filename,
+                  const szgI2CAdapter *adapter)
+{
+	int i;
+
+	bus->adapter = adapter;
+	bus->slave_addr = -1;
+	bus->funcs = 0;
+	for (i = 0; i < SZG_I2C_NUM_ADDRS; i++) {
+		bus->chunk_length[i] = SZG_I2C_CHUNK_LENGTH;
+		bus->page_size[i] = SZG_I2C_PAGE_SIZE;
+		bus->write_cycle_us[i] = 0;
+	}
+	bus->probe_mode = SZG_I2C_PROBE_AUTO;
+	bus->write_timeout_us = SZG_I2C_WRITE_TIMEOUT_US;
+	bus->poll_backoff_us = SZG_I2C_POLL_BACKOFF_US;
+	bus->poll_backoff_max_us = SZG_I2C_POLL_BACKOFF_MAX_US;
+	bus->write_polls = 0;
+	bus->transactions = 0;
+	if (szgI2CFileOpen(bus, filename) != 0) {
+		return(-1);
+	}
+
+	// Adapters that can't report their functionality fall back to plain
+	// read() and write() calls.
+	if (szgI2CIoctl(bus, I2C_FUNCS, (unsigned long)&bus->funcs) < 0) {
+		bus->funcs = 0;
+	}
+
+	return(0);
+}
+
+
+/// Closes the i2c device associated with a bus handle.
+void
+szgI2CClose(szgI2CBus *bus)
+{
+	if (bus->file >= 0) {
+		szgI2CFileClose(bus);
+	}
+	bus->file = -1;
+	bus->slave_addr = -1;
+	bus->funcs = 0;
+}
+
+
+/// Opens the shared handle of a device pool. Device handles are opened on
+/// demand by szgI2CPoolDevice.
+///
+/// \returns -1 if the device could not be opened. 0 on success.
+int
+szgI2CPoolOpen(szgI2CPool *pool, const char *filename)
+{
+	return(szgI2CPoolOpenAdapter(pool, filename, NULL));
+}
+
+
+/// Opens the shared handle of a device pool on the given adapter, the Linux
+/// i2c-dev driver if it is NULL. Device handles use the same adapter.
+///
+/// \returns -1 if the device could not be opened. 0 on success.
+int
+szgI2CPoolOpenAdapter(szgI2CPool *pool, const char *filename,
+                      const szgI2CAdapter *adapter)
+{
+	pool->count = 0;
+	strncpy(pool->filename, filename, SZG_I2C_PATH_LENGTH - 1);
+	pool->filename[SZG_I2C_PATH_LENGTH - 1] = '\0';
+
+	return(szgI2COpenAdapter(&pool->bus, pool->filename, adapter));
+}
+
+
+/// Closes the shared handle and every device handle of a pool.
+void
+szgI2CPoolClose(szgI2CPool *pool)
+{
+	int i;
+
+	for (i = 0; i < pool->count; i++) {
+		szgI2CClose(&pool->devs[i]);
+	}
+	pool->count = 0;
+	szgI2CClose(&pool->bus);
+}
+
+
+/// Retrieves the handle dedicated to a device, opening it and binding its
+/// I2C_SLAVE address if this is the first request for that address. The new
+/// handle starts with the settings of the pool's shared handle.
+///
+/// \returns The device handle, NULL if it could not be opened.
+szgI2CBus *
+szgI2CPoolDevice(szgI2CPool *pool, int i2c_addr)
+{
+	szgI2CBus *dev;
+	int i;
+
+	for (i = 0; i < pool->count; i++) {
+		if (pool->addrs[i] == i2c_addr) {
+			return(&pool->devs[i]);
+		}
+	}
+
+	if (pool->count >= SZG_I2C_POOL_SIZE) {
+		return(NULL);
+	}
+
+	dev = &pool->devs[pool->count];
+	*dev = pool->bus;
+	dev->slave_addr = -1;
+	dev->transactions = 0;
+	if (szgI2CFileOpen(dev, pool->filename) != 0) {
+		return(NULL);
+	}
+
+	if (szgI2CSetSlave(dev, i2c_addr) != 0) {
+		szgI2CClose(dev);
+		return(NULL);
+	}
+
+	pool->addrs[pool->count] = i2c_addr;
+	pool->count++;
+
+	return(dev);
+}
+
+
+/// Issues a set of combined I2C messages with a single I2C_RDWR call. The
+/// adapter generates a repeated start between messages.
+///
+/// \returns -1 if the call failed. 0 on success.
+static int
+szgI2CTransfer(szgI2CBus *bus, struct i2c_msg *msgs, int count)
+{
+	struct i2c_rdwr_ioctl_data xfer;
+
+	xfer.msgs = msgs;
+	xfer.nmsgs = count;
+
+	bus->transactions++;
+	if (szgI2CIoctl(bus, I2C_RDWR, (unsigned long)&xfer) != count) {
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+/// Stores a 16- or 8-bit sub-address in transmit order.
+static void
+szgI2CPackSubAddr(uint8_t *buf, uint16_t sub_addr, int sub_addr_length)
+{
+	if (sub_addr_length == 2) {
+		buf[0] = (sub_addr >> 8) & 0xFF;
+		buf[1] = sub_addr & 0xFF;
+	} else {
+		buf[0] = sub_addr & 0xFF;
+	}
+}
+
+
+/// Selects the target device for subsequent read() and write() calls. The
+/// I2C_SLAVE ioctl is only issued when the address differs from the one
+/// currently programmed on the handle.
+///
+/// \returns -1 if the address could not be set. 0 on success.
+int
+szgI2CSetSlave(szgI2CBus *bus, int i2c_addr)
+{
+	if (bus->slave_addr == i2c_addr) {
+		return(0);
+	}
+
+	if (szgI2CIoctl(bus, I2C_SLAVE, i2c_addr) < 0) {
+		bus->slave_addr = -1;
+		return(-1);
+	}
+
+	bus->slave_addr = i2c_addr;
+	return(0);
+}
+
+
+/// \returns The chunk length readMCU and writeMCU use for a device.
+int
+szgI2CChunkLength(szgI2CBus *bus, int i2c_addr)
+{
+	return(bus->chunk_length[i2c_addr & (SZG_I2C_NUM_ADDRS - 1)]);
+}
+
+
+/// Sets the chunk length used for a device to the largest value that both
+/// the peripheral (length) and the transport, SZG_I2C_MAX_CHUNK_LENGTH,
+/// support.
+///
+/// \returns The chunk length selected.
+int
+szgI2CSetChunkLength(szgI2CBus *bus, int i2c_addr, int length)
+{
+	if (length > SZG_I2C_MAX_CHUNK_LENGTH) {
+		length = SZG_I2C_MAX_CHUNK_LENGTH;
+	}
+	if (length < SZG_I2C_CHUNK_LENGTH) {
+		length = SZG_I2C_CHUNK_LENGTH;
+	}
+
+	bus->chunk_length[i2c_addr & (SZG_I2C_NUM_ADDRS - 1)] = length;
+	return(length);
+}
+
+
+/// \returns The write page size of a device, 0 if unknown.
+int
+szgI2CPageSize(szgI2CBus *bus, int i2c_addr)
+{
+	return(bus->page_size[i2c_addr & (SZG_I2C_NUM_ADDRS - 1)]);
+}
+
+
+/// Sets the write page size of a device, 0 if unknown. writeMCU splits
+/// writes so that no chunk crosses a page boundary, as a chunk spanning two
+/// pages costs the device two write cycles.
+///
+/// \returns The page size set.
+int
+szgI2CSetPageSize(szgI2CBus *bus, int i2c_addr, int page_size)
+{
+	if ((page_size < 0) || (page_size > 0xFFFF)) {
+		page_size = 0;
+	}
+
+	bus->page_size[i2c_addr & (SZG_I2C_NUM_ADDRS - 1)] = page_size;
+	return(page_size);
+}
+
+
+/// \returns The write cycle measured for a device in microseconds, 0 if it
+/// has not been measured yet.
+int
+szgI2CWriteCycle(szgI2CBus *bus, int i2c_addr)
+{
+	return(bus->write_cycle_us[i2c_addr & (SZG_I2C_NUM_ADDRS - 1)]);
+}
+
+
+/// Issues an SMBus quick write, a bare address phase with no data, to the
+/// currently selected device.
+///
+/// \returns -1 if the call failed. 0 on success.
+static int
+szgI2CQuickWrite(szgI2CBus *bus)
+{
+	struct i2c_smbus_ioctl_data args;
+
+	args.read_write = I2C_SMBUS_WRITE;
+	args.command = 0;
+	args.size = I2C_SMBUS_QUICK;
+	args.data = NULL;
+
+	bus->transactions++;
+	if (szgI2CIoctl(bus, I2C_SMBUS, (unsigned long)&args) < 0) {
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+/// Detects if a device is on a given I2C address using the probing mode
+/// selected on the bus handle.
+///
+/// \returns 0 if present, 1 if not present, -1 on error.
+int
+i2cDetect(szgI2CBus *bus, int i2c_addr)
+{
+	uint8_t data[2];
+	int quick;
+
+	if (szgI2CSetSlave(bus, i2c_addr) != 0) {
+		return(-1);
+	}
+
+	switch (bus->probe_mode) {
+		case SZG_I2C_PROBE_QUICK:
+			quick = 1;
+			break;
+		case SZG_I2C_PROBE_WRITE:
+			quick = 0;
+			break;
+		default:
+			quick = (bus->funcs & I2C_FUNC_SMBUS_QUICK) ? 1 : 0;
+			break;
+	}
+
+	if (quick) {
+		if (szgI2CQuickWrite(bus) != 0) {
+			return(1); // I2C device not present
+		}
+		return(0); // I2C device present
+	}
+
+	data[0] = 0x00;
+	data[1] = 0x00;
+
+	bus->transactions++;
+	if (szgI2CFileWrite(bus, data, 2) != 2) {
+		return(1); // I2C device not present
+	}
+
+	return(0); // I2C device present
+}
+
+
+/// Writes up to SZG_I2C_MAX_CHUNK_LENGTH bytes to I2C with either a 16- or
+/// 8-bit sub-address. While the device NAKs, the write is retried with an
+/// exponential backoff until the bus write timeout expires. The number of
+/// attempts is left in bus->write_polls.
+///
+/// \returns -1 if the call failed. 0 on success.
+int
+i2cWrite(szgI2CBus *bus, int i2c_addr, uint16_t sub_addr,
+         int sub_addr_length, int length, const uint8_t *data)
+{
+	uint8_t buffer[SZG_I2C_MAX_SUB_ADDR_LENGTH + SZG_I2C_MAX_CHUNK_LENGTH];
+	uint64_t deadline;
+	unsigned int backoff;
+
+	bus->write_polls = 0;
+
+	if ((length > SZG_I2C_MAX_CHUNK_LENGTH)
+	    || (sub_addr_length > SZG_I2C_MAX_SUB_ADDR_LENGTH)) {
+		return(-1);
+	}
+
+	memcpy(buffer + sub_addr_length, data, length * sizeof(uint8_t));
+
+	if (szgI2CSetSlave(bus, i2c_addr) != 0) {
+		return(-1);
+	}
+
+	szgI2CPackSubAddr(buffer, sub_addr, sub_addr_length);
+
+	deadline = szgI2CBusTimeUs(bus) + bus->write_timeout_us;
+	backoff = bus->poll_backoff_us;
+
+	while (1) {
+		// The DNA Spec allows an MCU to NAK subsequent writes when multiple
+		// writes are performed, keep trying until the deadline passes.
+		bus->write_polls++;
+		bus->transactions++;
+		if (szgI2CFileWrite(bus, buffer, sub_addr_length + length)
+		      == (length + sub_addr_length)) {
+			return(0);
+		}
+
+		if (szgI2CBusTimeUs(bus) >= deadline) {
+			break;
+		}
+
+		szgI2CBusSleepUs(bus, backoff);
+		backoff *= 2;
+		if (backoff > bus->poll_backoff_max_us) {
+			backoff = bus->poll_backoff_max_us;
+		}
+	}
+
+	// We gave up trying to write
+	return(-1);
+}
+
+
+/// Reads from I2C with either a 16- or 8-bit sub-address. The sub-address
+/// and the data are sent as one combined transfer when the adapter allows.
+///
+/// \returns -1 if the call failed. 0 on success.
+int
+i2cRead(szgI2CBus *bus, int i2c_addr, uint16_t sub_addr,
+        int sub_addr_length, int length, uint8_t *data)
+{
+	uint8_t temp_buf[2];
+	struct i2c_msg msgs[2];
+
+	szgI2CPackSubAddr(temp_buf, sub_addr, sub_addr_length);
+
+	if (bus->funcs & I2C_FUNC_I2C) {
+		msgs[0].addr = i2c_addr;
+		msgs[0].flags = 0;
+		msgs[0].len = sub_addr_length;
+		msgs[0].buf = temp_buf;
+		msgs[1].addr = i2c_addr;
+		msgs[1].flags = I2C_M_RD;
+		msgs[1].len = length;
+		msgs[1].buf = data;
+
+		return(szgI2CTransfer(bus, msgs, 2));
+	}
+
+	if (szgI2CSetSlave(bus, i2c_addr) != 0) {
+		return(-1);
+	}
+
+	bus->transactions += 2;
+	if (szgI2CFileWrite(bus, temp_buf, sub_addr_length) != sub_addr_length) {
+		return(-1);
+	}
+
+	if (szgI2CFileRead(bus, data, length) != length) {
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+/// Writes a buffer of any length to a SYZYGY MCU, splitting it into
+/// transfers of the chunk length negotiated for the device. When the page
+/// size of the device is known, chunks also end at page boundaries. Once
+/// the device's write cycle has been measured, each chunk is issued after
+/// waiting it out instead of polling through NAKs.
+///
+/// \returns -1 if the call failed. 0 on success.
+int
+writeMCU(szgI2CBus *bus, uint16_t port_addr, int sub_addr,
+         const uint8_t *data, int length)
+{
+	int temp_length, current_sub_addr;
+	int chunk_length = szgI2CChunkLength(bus, port_addr);
+	int page_size = szgI2CPageSize(bus, port_addr);
+	uint32_t *write_cycle = &bus->write_cycle_us[port_addr & (SZG_I2C_NUM_ADDRS - 1)];
+	uint64_t prev_end = 0;
+	uint64_t now;
+
+	// Useful for debug
+	//printf("Writing %d bytes to 0x%X, sub-address 0x%X\n", length, port_addr, sub_addr);
+
+	current_sub_addr = sub_addr;
+
+	while (length > 0) {
+		temp_length = (length > chunk_length) ? chunk_length : length;
+
+		// Keep the chunk within one page
+		if ((page_size > 0)
+		    && (temp_length > page_size - (current_sub_addr % page_size))) {
+			temp_length = page_size - (current_sub_addr % page_size);
+		}
+
+		// Wait out the previous chunk's write cycle rather than polling
+		if ((prev_end != 0) && (*write_cycle > 0)) {
+			now = szgI2CBusTimeUs(bus);
+			if (now < prev_end + *write_cycle) {
+				szgI2CBusSleepUs(bus, prev_end + *write_cycle - now);
+			}
+		}
+
+		if (i2cWrite(bus, port_addr, current_sub_addr, 2, temp_length,
+		             &data[(current_sub_addr - sub_addr)]) != 0) {
+			return(-1);
+		}
+
+		// A NAK'd write bounds the write cycle from above. Writes acked at
+		// once may have waited longer than needed, so the estimate creeps
+		// down until the device NAKs again.
+		now = szgI2CBusTimeUs(bus);
+		if (prev_end != 0) {
+			if (bus->write_polls > 1) {
+				*write_cycle = now - prev_end;
+			} else if (*write_cycle > 0) {
+				*write_cycle -= *write_cycle / 16;
+			}
+		}
+		prev_end = now;
+
+		current_sub_addr += temp_length;
+		length -= temp_length;
+	}
+
+	return(0);
+}
+
+
+/// Reads a buffer of any length from a SYZYGY MCU, splitting it into
+/// transfers of the chunk length negotiated for the device. Each chunk is
+/// its own sub-address write and read. Chunks are not packed into a single
+/// I2C_RDWR call, as controllers such as the Zynq-7000 PS Cadence I2C
+/// reject messages following a read in the same transfer.
+///
+/// \returns -1 if the call failed. 0 on success.
+int
+readMCU(szgI2CBus *bus, uint16_t port_addr, int sub_addr, uint8_t *data,
+        int length)
+{
+	int current_sub_addr, temp_length;
+	int chunk_length = szgI2CChunkLength(bus, port_addr);
+
+	// Useful for debug
+	//printf("Reading %d bytes from 0x%X, sub-address 0x%X\n", length, port_addr, sub_addr);
+
+	current_sub_addr = sub_addr;
+
+	while (length > 0) {
+		temp_length = (length > chunk_length) ? chunk_length : length;
+
+		if (i2cRead(bus, port_addr, current_sub_addr, 2, temp_length,
+		            &data[(current_sub_addr - sub_addr)]) != 0) {
+			return(-1);
+		}
+
+		current_sub_addr += temp_length;
+		length -= temp_length;
+	}
+
+	return(0);
+}
+
+
+/// Detects a SYZYGY MCU and reads from it in the same transfer. On adapters
+/// supporting I2C_RDWR, a missing device is recognized from the address NAK
+/// of the read itself, so a present peripheral costs no extra probe.
+///
+/// \returns 0 if present and read, 1 if not present, -1 on error.
+int
+detectReadMCU(szgI2CBus *bus, uint16_t port_addr, int sub_addr,
+              uint8_t *data, int length)
+{
+	int present;
+
+	if (!(bus->funcs & I2C_FUNC_I2C)) {
+		present = i2cDetect(bus, port_addr);
+		if (present != 0) {
+			return(present);
+		}
+		return(readMCU(bus, port_addr, sub_addr, data, length));
+	}
+
+	if (readMCU(bus, port_addr, sub_addr, data, length) == 0) {
+		return(0);
+	}
+
+	// Adapters report a NAK during the address phase as ENXIO
+	if (errno == ENXIO) {
+		return(1);
+	}
+
+	// Otherwise, tell a missing device apart from a failed read
+	present = i2cDetect(bus, port_addr);
+	return((present == 0) ? -1 : present);
+}
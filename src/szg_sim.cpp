@@ -0,0 +1,599 @@
+// SYZYGY Carrier Simulator
+//
+// In-process model of a SYZYGY carrier, usable as a bus policy.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "szg_sim.hpp"
+
+
+szgSimBus::szgSimBus ()
+{
+	int i;
+
+	adapter.ctx = this;
+	adapter.open = adapterOpen;
+	adapter.close = adapterClose;
+	adapter.ioctl = adapterIoctl;
+	adapter.read = adapterRead;
+	adapter.write = adapterWrite;
+	adapter.time_us = adapterTimeUs;
+	adapter.sleep_us = adapterSleepUs;
+
+	for (i = 0; i < SZG_SIM_NUM_FILES; i++) {
+		file_addr[i] = -2;
+	}
+
+	reset();
+}
+
+
+// Resets the carrier to an empty state with default timing
+void szgSimBus::reset ()
+{
+	int i;
+
+	bus_hz = SZG_SIM_BUS_HZ;
+	txn_overhead_us = SZG_SIM_TXN_OVERHEAD_US;
+	write_cycle_us = SZG_SIM_WRITE_CYCLE_US;
+	read_last = 1;
+
+	for (i = 0; i < SZG_SIM_NUM_MCUS; i++) {
+		mcus[i].present = 0;
+		mcus[i].max_read_length = SZG_I2C_CHUNK_LENGTH;
+		mcus[i].page_size = SZG_SIM_PAGE_SIZE;
+		memset(mcus[i].dna, 0xFF, sizeof(mcus[i].dna));
+		memset(mcus[i].seq, 0x00, sizeof(mcus[i].seq));
+		mcus[i].pointer = 0;
+		mcus[i].busy_until_ns = 0;
+	}
+
+	// The TPS65400 powers up with writes to everything but the write
+	// protect register blocked
+	tps.present = 1;
+	tps.write_protect = 0x80;
+	tps.page = 0;
+	memset(tps.vref, 0x00, sizeof(tps.vref));
+	tps.reg = 0;
+	tps.protected_writes = 0;
+
+	memset(&stats, 0, sizeof(stats));
+	now_ns = 0;
+}
+
+
+// Loads up to max_length bytes from a file, returns the number of bytes read
+static int loadFile (const char *filename, uint8_t *data, int max_length)
+{
+	int file;
+	int length = 0;
+	int result = 0;
+
+	file = ::open(filename, O_RDONLY);
+	if (file < 0) {
+		return -1;
+	}
+
+	while (length < max_length) {
+		result = ::read(file, data + length, max_length - length);
+		if (result <= 0) {
+			break;
+		}
+		length += result;
+	}
+	::close(file);
+
+	return (result < 0) ? -1 : length;
+}
+
+
+// Builds the carrier from a description file, see szg_sim.hpp
+int szgSimBus::open (const char *name)
+{
+	char text[SZG_SIM_DESC_SIZE + 1];
+	char *line;
+	char *next;
+	char key[64];
+	char arg[400];
+	unsigned int value;
+	int port;
+	int length;
+	int line_num = 0;
+
+	reset();
+
+	length = loadFile(name, (uint8_t *)text, SZG_SIM_DESC_SIZE + 1);
+	if (length < 0) {
+		fprintf(stderr, "sim: cannot open carrier description %s\n", name);
+		return -1;
+	} else if (length > SZG_SIM_DESC_SIZE) {
+		fprintf(stderr, "sim: carrier description %s is too long\n", name);
+		return -1;
+	}
+	text[length] = '\0';
+
+	for (line = text; line != NULL; line = next) {
+		next = strchr(line, '\n');
+		if (next != NULL) {
+			*next++ = '\0';
+		}
+		line_num++;
+
+		if ((sscanf(line, "%63s", key) != 1) || (key[0] == '#')) {
+			continue;
+		}
+
+		if (strcmp(key, "bus_hz") == 0 && sscanf(line, "%*s %u", &value) == 1) {
+			bus_hz = value;
+		} else if (strcmp(key, "txn_overhead_us") == 0
+		           && sscanf(line, "%*s %u", &value) == 1) {
+			txn_overhead_us = value;
+		} else if (strcmp(key, "write_cycle_us") == 0
+		           && sscanf(line, "%*s %u", &value) == 1) {
+			write_cycle_us = value;
+		} else if (strcmp(key, "tps") == 0
+		           && sscanf(line, "%*s %u", &value) == 1) {
+			tps.present = (value != 0);
+		} else if (strcmp(key, "read_last") == 0
+		           && sscanf(line, "%*s %u", &value) == 1) {
+			read_last = (value != 0);
+		} else if (strcmp(key, "port") == 0
+		           && sscanf(line, "%*s %d %399s", &port, arg) == 2
+		           && port >= 1 && port <= SZG_SIM_NUM_MCUS) {
+			if (loadFile(arg, mcus[port - 1].dna, SZG_SIM_DNA_SIZE) < 0) {
+				fprintf(stderr, "sim: %s:%d: cannot read %s\n", name, line_num, arg);
+				return -1;
+			}
+			mcus[port - 1].present = 1;
+		} else if (strcmp(key, "seq") == 0
+		           && sscanf(line, "%*s %d %399s", &port, arg) == 2
+		           && port >= 1 && port <= SZG_SIM_NUM_MCUS) {
+			if (loadFile(arg, mcus[port - 1].seq, SZG_SIM_SEQ_SIZE) < 0) {
+				fprintf(stderr, "sim: %s:%d: cannot read %s\n", name, line_num, arg);
+				return -1;
+			}
+		} else if (strcmp(key, "read_length") == 0
+		           && sscanf(line, "%*s %d %u", &port, &value) == 2
+		           && port >= 1 && port <= SZG_SIM_NUM_MCUS && value > 0) {
+			mcus[port - 1].max_read_length = value;
+		} else if (strcmp(key, "page_size") == 0
+		           && sscanf(line, "%*s %d %u", &port, &value) == 2
+		           && port >= 1 && port <= SZG_SIM_NUM_MCUS) {
+			mcus[port - 1].page_size = value;
+		} else {
+			fprintf(stderr, "sim: %s:%d: invalid setting\n", name, line_num);
+			return -1;
+		}
+	}
+
+	if (bus_hz == 0) {
+		fprintf(stderr, "sim: bus_hz must be non-zero\n");
+		return -1;
+	}
+
+	return connect(name);
+}
+
+
+void szgSimBus::close ()
+{
+	disconnect();
+	report();
+}
+
+
+int szgSimBus::connect (const char *name)
+{
+	return szgI2CPoolOpenAdapter(&pool, name, &adapter);
+}
+
+
+void szgSimBus::disconnect ()
+{
+	szgI2CPoolClose(&pool);
+}
+
+
+void szgSimBus::report ()
+{
+	int i;
+
+	fprintf(stderr, "sim: %lu transactions, %lu messages, %lu bytes, %lu NAKs\n",
+	        stats.transactions, stats.messages, stats.bytes, stats.naks);
+	fprintf(stderr, "sim: bus time %.3f ms at %u Hz\n",
+	        stats.bus_time_ns / 1e6, bus_hz);
+
+	for (i = 0; i < 2; i++) {
+		if (tps.vref[i] == 0) {
+			continue;
+		}
+		// TPS65400 VREF = VOUT * 531 - 60
+		fprintf(stderr, "sim: VIO%d VREF 0x%02X (%d0 mV)\n", i + 1, tps.vref[i],
+		        (tps.vref[i] + 60) * 1000 / 531);
+	}
+	if (tps.protected_writes != 0) {
+		fprintf(stderr, "sim: %lu TPS65400 writes blocked by write protect\n",
+		        tps.protected_writes);
+	}
+}
+
+
+szgSimMCU *szgSimBus::mcu (int i2c_addr)
+{
+	if ((i2c_addr < SZG_SIM_MCU_BASE_ADDR)
+	    || (i2c_addr >= SZG_SIM_MCU_BASE_ADDR + SZG_SIM_NUM_MCUS)) {
+		return NULL;
+	}
+
+	return &mcus[i2c_addr - SZG_SIM_MCU_BASE_ADDR];
+}
+
+
+void szgSimBus::load (int i2c_addr, int sub_addr, const uint8_t *data,
+                      int length)
+{
+	szgSimMCU *m = mcu(i2c_addr);
+	uint64_t busy_until_ns;
+
+	if (m == NULL) {
+		return;
+	}
+
+	busy_until_ns = m->busy_until_ns;
+	mcuWrite(m, sub_addr, data, length);
+	m->busy_until_ns = busy_until_ns;
+	m->present = 1;
+}
+
+
+// Returns non-zero if a device would ACK its address right now
+int szgSimBus::ack (int i2c_addr)
+{
+	szgSimMCU *m = mcu(i2c_addr);
+
+	if (m != NULL) {
+		return m->present && (now_ns >= m->busy_until_ns);
+	}
+
+	return (i2c_addr == SZG_SIM_TPS_ADDR) && tps.present;
+}
+
+
+// Accounts for one adapter call carrying the given messages and bytes. Each
+// message costs a (repeated) start bit, each byte nine bits, and the call a
+// stop bit plus the fixed call overhead.
+void szgSimBus::transaction (int messages, int bytes)
+{
+	uint64_t bits = (uint64_t)bytes * 9 + messages + 1;
+	uint64_t ns = (uint64_t)txn_overhead_us * 1000
+	              + bits * 1000000000ULL / bus_hz;
+
+	stats.transactions++;
+	stats.messages += messages;
+	stats.bytes += bytes;
+	stats.bus_time_ns += ns;
+	now_ns += ns;
+}
+
+
+// Accounts for a call NAK'd on its address byte
+void szgSimBus::nak ()
+{
+	stats.naks++;
+	transaction(1, 1);
+}
+
+
+void szgSimBus::mcuRead (szgSimMCU *m, int sub_addr, uint8_t *data, int length)
+{
+	int i, addr;
+
+	for (i = 0; i < length; i++) {
+		addr = sub_addr + ((m != NULL) ? (i % m->max_read_length) : i);
+
+		if ((m != NULL) && (addr >= SZG_SIM_DNA_ADDR)
+		    && (addr < SZG_SIM_DNA_ADDR + SZG_SIM_DNA_SIZE)) {
+			data[i] = m->dna[addr - SZG_SIM_DNA_ADDR];
+		} else if ((m != NULL) && (addr >= SZG_SIM_SEQ_ADDR)
+		           && (addr < SZG_SIM_SEQ_ADDR + SZG_SIM_SEQ_SIZE)) {
+			data[i] = m->seq[addr - SZG_SIM_SEQ_ADDR];
+		} else {
+			data[i] = 0xFF;
+		}
+	}
+}
+
+
+void szgSimBus::mcuWrite (szgSimMCU *m, int sub_addr, const uint8_t *data,
+                          int length)
+{
+	int i, addr;
+	int pages;
+
+	for (i = 0; i < length; i++) {
+		addr = sub_addr + i;
+
+		if ((addr >= SZG_SIM_DNA_ADDR)
+		    && (addr < SZG_SIM_DNA_ADDR + SZG_SIM_DNA_SIZE)) {
+			m->dna[addr - SZG_SIM_DNA_ADDR] = data[i];
+		} else if ((addr >= SZG_SIM_SEQ_ADDR)
+		           && (addr < SZG_SIM_SEQ_ADDR + SZG_SIM_SEQ_SIZE)) {
+			m->seq[addr - SZG_SIM_SEQ_ADDR] = data[i];
+		}
+	}
+
+	// The MCU commits the write one page at a time and NAKs until it is
+	// done. Writes of a sub-address alone only move its address pointer.
+	if (length > 0) {
+		pages = 1;
+		if (m->page_size > 0) {
+			pages = (sub_addr + length - 1) / m->page_size
+			        - sub_addr / m->page_size + 1;
+		}
+		m->busy_until_ns = now_ns + (uint64_t)write_cycle_us * 1000 * pages;
+	}
+}
+
+
+void szgSimBus::tpsWrite (uint8_t reg, uint8_t value)
+{
+	if (reg == SZG_SIM_TPS_REG_WRITE_PROTECT) {
+		tps.write_protect = value;
+	} else if (tps.write_protect & 0x80) {
+		tps.protected_writes++;
+	} else if (reg == SZG_SIM_TPS_REG_PAGE) {
+		tps.page = value % SZG_SIM_TPS_NUM_PAGES;
+	} else if (reg == SZG_SIM_TPS_REG_VREF) {
+		tps.vref[tps.page] = value;
+	}
+}
+
+
+uint8_t szgSimBus::tpsRead (uint8_t reg)
+{
+	switch (reg) {
+		case SZG_SIM_TPS_REG_WRITE_PROTECT:
+			return tps.write_protect;
+		case SZG_SIM_TPS_REG_PAGE:
+			return tps.page;
+		case SZG_SIM_TPS_REG_VREF:
+			return tps.vref[tps.page];
+		default:
+			return 0x00;
+	}
+}
+
+
+// Reads from the device at its current pointer
+void szgSimBus::deviceRead (int i2c_addr, uint8_t *data, int length)
+{
+	szgSimMCU *m = mcu(i2c_addr);
+	int i;
+
+	if (m != NULL) {
+		mcuRead(m, m->pointer, data, length);
+		return;
+	}
+
+	for (i = 0; i < length; i++) {
+		data[i] = tpsRead(tps.reg);
+	}
+}
+
+
+// Writes a message to a device: a 16-bit sub-address and data for an MCU,
+// a register and a value for the TPS65400
+void szgSimBus::deviceWrite (int i2c_addr, const uint8_t *data, int length)
+{
+	szgSimMCU *m = mcu(i2c_addr);
+
+	if (m != NULL) {
+		if (length >= 2) {
+			m->pointer = (data[0] << 8) | data[1];
+			mcuWrite(m, m->pointer, &data[2], length - 2);
+		}
+		return;
+	}
+
+	if (length >= 1) {
+		tps.reg = data[0];
+	}
+	if (length >= 2) {
+		tpsWrite(tps.reg, data[1]);
+	}
+}
+
+
+// Combined transfer: the messages run back to back with repeated starts,
+// and a NAK of the address aborts the whole transfer
+int szgSimBus::rdwr (void *arg)
+{
+	struct i2c_rdwr_ioctl_data *xfer = (struct i2c_rdwr_ioctl_data *)arg;
+	unsigned int i;
+	int bytes = 0;
+
+	for (i = 0; i + 1 < xfer->nmsgs; i++) {
+		if (read_last && (xfer->msgs[i].flags & I2C_M_RD)) {
+			errno = EOPNOTSUPP;
+			return -1;
+		}
+	}
+
+	for (i = 0; i < xfer->nmsgs; i++) {
+		if (!ack(xfer->msgs[i].addr)) {
+			nak();
+			errno = ENXIO;
+			return -1;
+		}
+	}
+
+	for (i = 0; i < xfer->nmsgs; i++) {
+		if (xfer->msgs[i].flags & I2C_M_RD) {
+			deviceRead(xfer->msgs[i].addr, xfer->msgs[i].buf, xfer->msgs[i].len);
+		} else {
+			deviceWrite(xfer->msgs[i].addr, xfer->msgs[i].buf, xfer->msgs[i].len);
+		}
+		bytes += 1 + xfer->msgs[i].len;
+	}
+
+	transaction(xfer->nmsgs, bytes);
+	return xfer->nmsgs;
+}
+
+
+int szgSimBus::adapterOpen (void *ctx, const char *filename)
+{
+	szgSimBus *sim = (szgSimBus *)ctx;
+	int i;
+
+	for (i = 0; i < SZG_SIM_NUM_FILES; i++) {
+		if (sim->file_addr[i] == -2) {
+			sim->file_addr[i] = -1;
+			return i;
+		}
+	}
+
+	errno = EMFILE;
+	return -1;
+}
+
+
+void szgSimBus::adapterClose (void *ctx, int file)
+{
+	szgSimBus *sim = (szgSimBus *)ctx;
+
+	if ((file >= 0) && (file < SZG_SIM_NUM_FILES)) {
+		sim->file_addr[file] = -2;
+	}
+}
+
+
+// The adapter supports plain I2C messages and SMBus quick writes
+int szgSimBus::adapterIoctl (void *ctx, int file, unsigned long request,
+                             unsigned long arg)
+{
+	szgSimBus *sim = (szgSimBus *)ctx;
+	struct i2c_smbus_ioctl_data *args;
+
+	if ((file < 0) || (file >= SZG_SIM_NUM_FILES) || (sim->file_addr[file] == -2)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	switch (request) {
+		case I2C_FUNCS:
+			*(unsigned long *)arg = I2C_FUNC_I2C | I2C_FUNC_SMBUS_QUICK;
+			return 0;
+		case I2C_SLAVE:
+			sim->file_addr[file] = arg;
+			return 0;
+		case I2C_RDWR:
+			return sim->rdwr((void *)arg);
+		case I2C_SMBUS:
+			args = (struct i2c_smbus_ioctl_data *)arg;
+			if (args->size != I2C_SMBUS_QUICK) {
+				break;
+			}
+			if (!sim->ack(sim->file_addr[file])) {
+				sim->nak();
+				errno = ENXIO;
+				return -1;
+			}
+			sim->transaction(1, 1);
+			return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+
+int szgSimBus::adapterRead (void *ctx, int file, uint8_t *data, int length)
+{
+	szgSimBus *sim = (szgSimBus *)ctx;
+	int addr;
+
+	if ((file < 0) || (file >= SZG_SIM_NUM_FILES) || (sim->file_addr[file] == -2)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	addr = sim->file_addr[file];
+	if (!sim->ack(addr)) {
+		sim->nak();
+		errno = ENXIO;
+		return -1;
+	}
+
+	sim->transaction(1, 1 + length);
+	sim->deviceRead(addr, data, length);
+	return length;
+}
+
+
+int szgSimBus::adapterWrite (void *ctx, int file, const uint8_t *data,
+                             int length)
+{
+	szgSimBus *sim = (szgSimBus *)ctx;
+	int addr;
+
+	if ((file < 0) || (file >= SZG_SIM_NUM_FILES) || (sim->file_addr[file] == -2)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	addr = sim->file_addr[file];
+	if (!sim->ack(addr)) {
+		sim->nak();
+		errno = ENXIO;
+		return -1;
+	}
+
+	sim->transaction(1, 1 + length);
+	sim->deviceWrite(addr, data, length);
+	return length;
+}
+
+
+uint64_t szgSimBus::adapterTimeUs (void *ctx)
+{
+	return ((szgSimBus *)ctx)->now_ns / 1000;
+}
+
+
+// Sleeping only advances the simulated clock
+void szgSimBus::adapterSleepUs (void *ctx, unsigned int us)
+{
+	((szgSimBus *)ctx)->now_ns += (uint64_t)us * 1000;
+}
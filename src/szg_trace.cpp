@@ -0,0 +1,423 @@
+// SYZYGY Bus Traces
+//
+// Recording of bus traffic and replay of recorded traces.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "szg_trace.hpp"
+
+
+static const char *szgTraceOpNames[SZG_TRACE_NUM_OPS] = {
+	"detect", "write", "read", "writemcu", "readmcu", "detectreadmcu"
+};
+
+
+// Writes one operation to a trace file, see szg_trace.hpp for the format
+void szgTraceWrite (FILE *f, const szgTraceRecord &rec, const uint8_t *data)
+{
+	int i;
+
+	fprintf(f, "%llu %llu %lu %s 0x%02x 0x%04x %d %d %d ",
+	        (unsigned long long)rec.t_us, (unsigned long long)rec.dur_us,
+	        rec.transactions, szgTraceOpNames[rec.op], rec.addr, rec.sub_addr,
+	        rec.sub_addr_length, rec.length, rec.result);
+
+	if (data == NULL || rec.length == 0) {
+		fprintf(f, "-\n");
+		return;
+	}
+
+	for (i = 0; i < rec.length; i++) {
+		fprintf(f, "%02x", data[i]);
+	}
+	fprintf(f, "\n");
+}
+
+
+// Loads every operation of a trace file, returns -1 if it can't be parsed
+int szgTraceLoad (const char *filename, std::vector<szgTraceRecord> &records)
+{
+	FILE *f;
+	char line[8192];
+	char op[32];
+	char payload[sizeof(line)];
+	unsigned long long t_us, dur_us;
+	unsigned int byte;
+	szgTraceRecord rec;
+	int line_num = 0;
+	int i;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "replay: cannot open trace %s\n", filename);
+		return -1;
+	}
+
+	records.clear();
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		line_num++;
+
+		if ((line[0] == '#') || (line[0] == '\n')) {
+			continue;
+		}
+
+		if (sscanf(line, "%llu %llu %lu %31s %i %i %d %d %d %8191s", &t_us,
+		           &dur_us, &rec.transactions, op, &rec.addr, &rec.sub_addr,
+		           &rec.sub_addr_length, &rec.length, &rec.result,
+		           payload) != 10) {
+			fprintf(stderr, "replay: %s:%d: invalid record\n", filename, line_num);
+			fclose(f);
+			return -1;
+		}
+
+		rec.t_us = t_us;
+		rec.dur_us = dur_us;
+
+		for (rec.op = 0; rec.op < SZG_TRACE_NUM_OPS; rec.op++) {
+			if (strcmp(op, szgTraceOpNames[rec.op]) == 0) {
+				break;
+			}
+		}
+
+		rec.data.clear();
+		if (strcmp(payload, "-") != 0) {
+			for (i = 0; payload[2 * i] != '\0'; i++) {
+				if (sscanf(&payload[2 * i], "%2x", &byte) != 1) {
+					break;
+				}
+				rec.data.push_back(byte);
+			}
+		}
+
+		if ((rec.op == SZG_TRACE_NUM_OPS)
+		    || (!rec.data.empty() && (int)rec.data.size() != rec.length)) {
+			fprintf(stderr, "replay: %s:%d: invalid record\n", filename, line_num);
+			fclose(f);
+			return -1;
+		}
+
+		records.push_back(rec);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+
+szgReplayBus::szgReplayBus () : cursor(0), ops(0), matched(0), time_ns(0)
+{
+}
+
+
+// Loads the trace and rebuilds the carrier it was recorded on
+int szgReplayBus::open (const char *name)
+{
+	size_t i;
+	int tps_acked = 0;
+	int tps_failed = 0;
+
+	if (szgTraceLoad(name, records) != 0) {
+		return -1;
+	}
+
+	sim.reset();
+	used.assign(records.size(), 0);
+	cursor = 0;
+	ops = 0;
+	matched = 0;
+	time_ns = 0;
+
+	for (i = 0; i < records.size(); i++) {
+		const szgTraceRecord &rec = records[i];
+
+		if (rec.addr == SZG_SIM_TPS_ADDR) {
+			if (rec.result == 0) {
+				tps_acked = 1;
+			} else {
+				tps_failed = 1;
+			}
+			continue;
+		}
+
+		switch (rec.op) {
+			case SZG_TRACE_DETECT:
+				if (rec.result == 0 && sim.mcu(rec.addr) != NULL) {
+					sim.mcu(rec.addr)->present = 1;
+				}
+				break;
+			case SZG_TRACE_READ:
+			case SZG_TRACE_READ_MCU:
+			case SZG_TRACE_DETECT_READ_MCU:
+				if (rec.result == 0 && !rec.data.empty()) {
+					sim.load(rec.addr, rec.sub_addr, &rec.data[0], rec.length);
+				}
+				break;
+		}
+	}
+
+	sim.tps.present = tps_acked || !tps_failed;
+
+	calibrate();
+
+	return sim.connect(name);
+}
+
+
+// Fits the per-transaction overhead and per-byte time of the simulator to
+// the recorded durations with a least squares fit of
+//   duration = overhead * transactions + byte_time * bytes
+// Write operations are left out, as their durations include ACK polling.
+void szgReplayBus::calibrate ()
+{
+	double stt = 0, stb = 0, sbb = 0, sty = 0, sby = 0;
+	double t, b, y, det, overhead, byte_time;
+	size_t i;
+
+	for (i = 0; i < records.size(); i++) {
+		const szgTraceRecord &rec = records[i];
+
+		if ((rec.transactions == 0) || (rec.op == SZG_TRACE_WRITE)
+		    || (rec.op == SZG_TRACE_WRITE_MCU)) {
+			continue;
+		}
+
+		t = rec.transactions;
+		b = rec.sub_addr_length + rec.length;
+		y = rec.dur_us;
+		stt += t * t;
+		stb += t * b;
+		sbb += b * b;
+		sty += t * y;
+		sby += b * y;
+	}
+
+	det = stt * sbb - stb * stb;
+	if (det <= 0) {
+		return;
+	}
+
+	overhead = (sbb * sty - stb * sby) / det;
+	byte_time = (stt * sby - stb * sty) / det;
+	if ((overhead < 0) || (byte_time <= 0)) {
+		return;
+	}
+
+	// Each byte is nine bits on the wire
+	sim.txn_overhead_us = (unsigned int)(overhead + 0.5);
+	sim.bus_hz = (unsigned int)(9e6 / byte_time);
+	if (sim.bus_hz == 0) {
+		sim.bus_hz = 1;
+	}
+}
+
+
+// Finds the first recorded operation in [from, to) not matched yet with
+// the given op, address and sub-address, returns 'to' if there is none
+size_t szgReplayBus::find (size_t from, size_t to, int op, int addr,
+                           int sub_addr) const
+{
+	size_t i;
+
+	for (i = from; i < to; i++) {
+		const szgTraceRecord &rec = records[i];
+
+		if (!used[i] && (rec.op == op) && (rec.addr == addr)
+		    && (rec.sub_addr == sub_addr)) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+
+// Accounts for an operation of this run, charging its recorded duration
+// when it matches an operation of the recording. The match is searched for
+// ahead of the last one first, then among the recorded operations passed
+// over, so operations a change adds, drops or reorders do not throw off the
+// rest of the run. Operations without a match are charged by the calibrated
+// model.
+void szgReplayBus::charge (int op, int addr, int sub_addr, int length,
+                           uint64_t t0_ns)
+{
+	uint64_t ns = sim.now_ns - t0_ns;
+	size_t i;
+
+	ops++;
+
+	i = find(cursor, records.size(), op, addr, sub_addr);
+	if (i < records.size()) {
+		cursor = i + 1;
+	} else {
+		i = find(0, cursor, op, addr, sub_addr);
+		if (i == cursor) {
+			i = records.size();
+		}
+	}
+
+	if (i < records.size()) {
+		// A different length is the same operation, but not its duration
+		if (records[i].length == length) {
+			ns = records[i].dur_us * 1000;
+		}
+		used[i] = 1;
+		matched++;
+	}
+
+	time_ns += ns;
+}
+
+
+void szgReplayBus::close ()
+{
+	sim.disconnect();
+	report();
+}
+
+
+void szgReplayBus::report ()
+{
+	unsigned long rec_transactions = 0;
+	uint64_t rec_us = 0;
+	size_t i;
+
+	for (i = 0; i < records.size(); i++) {
+		rec_transactions += records[i].transactions;
+		rec_us += records[i].dur_us;
+	}
+
+	fprintf(stderr, "replay: recorded %lu ops, %lu transactions, %.3f ms\n",
+	        (unsigned long)records.size(), rec_transactions, rec_us / 1e3);
+	fprintf(stderr, "replay: this run %lu ops, %lu transactions, %.3f ms"
+	        " (%lu ops matched the recording)\n",
+	        ops, sim.stats.transactions, time_ns / 1e6, matched);
+	fprintf(stderr, "replay: %lu recorded ops not issued, %lu new ops charged"
+	        " by the model\n", (unsigned long)records.size() - matched,
+	        ops - matched);
+	fprintf(stderr, "replay: delta %+ld transactions, %+.3f ms\n",
+	        (long)sim.stats.transactions - (long)rec_transactions,
+	        time_ns / 1e6 - rec_us / 1e3);
+}
+
+
+int szgReplayBus::i2cDetect (int i2c_addr)
+{
+	uint64_t t0_ns = sim.now_ns;
+	int result = sim.i2cDetect(i2c_addr);
+
+	charge(SZG_TRACE_DETECT, i2c_addr, 0, 0, t0_ns);
+	return result;
+}
+
+
+int szgReplayBus::i2cWrite (int i2c_addr, uint16_t sub_addr,
+                            int sub_addr_length, int length,
+                            const uint8_t *data)
+{
+	uint64_t t0_ns = sim.now_ns;
+	int result = sim.i2cWrite(i2c_addr, sub_addr, sub_addr_length, length, data);
+
+	charge(SZG_TRACE_WRITE, i2c_addr, sub_addr, length, t0_ns);
+	return result;
+}
+
+
+int szgReplayBus::i2cRead (int i2c_addr, uint16_t sub_addr,
+                           int sub_addr_length, int length, uint8_t *data)
+{
+	uint64_t t0_ns = sim.now_ns;
+	int result = sim.i2cRead(i2c_addr, sub_addr, sub_addr_length, length, data);
+
+	charge(SZG_TRACE_READ, i2c_addr, sub_addr, length, t0_ns);
+	return result;
+}
+
+
+int szgReplayBus::writeMCU (uint16_t port_addr, int sub_addr,
+                            const uint8_t *data, int length)
+{
+	uint64_t t0_ns = sim.now_ns;
+	int result = sim.writeMCU(port_addr, sub_addr, data, length);
+
+	charge(SZG_TRACE_WRITE_MCU, port_addr, sub_addr, length, t0_ns);
+	return result;
+}
+
+
+int szgReplayBus::readMCU (uint16_t port_addr, int sub_addr, uint8_t *data,
+                           int length)
+{
+	uint64_t t0_ns = sim.now_ns;
+	int result = sim.readMCU(port_addr, sub_addr, data, length);
+
+	charge(SZG_TRACE_READ_MCU, port_addr, sub_addr, length, t0_ns);
+	return result;
+}
+
+
+int szgReplayBus::detectReadMCU (uint16_t port_addr, int sub_addr,
+                                 uint8_t *data, int length)
+{
+	uint64_t t0_ns = sim.now_ns;
+	int result = sim.detectReadMCU(port_addr, sub_addr, data, length);
+
+	charge(SZG_TRACE_DETECT_READ_MCU, port_addr, sub_addr, length, t0_ns);
+	return result;
+}
+
+
+int szgReplayBus::setChunkLength (int i2c_addr, int length)
+{
+	return sim.setChunkLength(i2c_addr, length);
+}
+
+
+int szgReplayBus::setPageSize (int i2c_addr, int page_size)
+{
+	return sim.setPageSize(i2c_addr, page_size);
+}
+
+
+int szgReplayBus::writeCycleUs (int i2c_addr)
+{
+	return sim.writeCycleUs(i2c_addr);
+}
+
+
+unsigned long szgReplayBus::transactions ()
+{
+	return sim.transactions();
+}
+
+
+// Time charged to this run so far, recorded durations included
+uint64_t szgReplayBus::timeUs ()
+{
+	return time_ns / 1000;
+}
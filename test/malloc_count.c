@@ -0,0 +1,75 @@
+// SYZYGY Heap Allocation Counter
+//
+// Preloadable library counting the heap allocations of a process, used by
+// the test target in the Makefile.
+//
+//------------------------------------------------------------------------
+// Copyright (c) 2014-2019 Opal Kelly Incorporated
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// 
+//------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <stddef.h>
+
+
+// glibc's own allocator entry points, which the wrappers forward to. Using
+// them rather than dlsym() keeps the wrappers from recursing while the
+// dynamic linker looks the symbols up.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long szgMallocCount;
+
+
+void *
+malloc(size_t size)
+{
+	__atomic_add_fetch(&szgMallocCount, 1, __ATOMIC_RELAXED);
+	return(__libc_malloc(size));
+}
+
+
+void *
+calloc(size_t count, size_t size)
+{
+	__atomic_add_fetch(&szgMallocCount, 1, __ATOMIC_RELAXED);
+	return(__libc_calloc(count, size));
+}
+
+
+void *
+realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&szgMallocCount, 1, __ATOMIC_RELAXED);
+	return(__libc_realloc(ptr, size));
+}
+
+
+/// Prints the number of allocations the process made to stderr as
+/// "malloc_count: <n>" once it exits.
+__attribute__((destructor)) static void
+szgMallocCountReport(void)
+{
+	fprintf(stderr, "malloc_count: %lu\n",
+	        __atomic_load_n(&szgMallocCount, __ATOMIC_RELAXED));
+}